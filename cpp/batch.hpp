@@ -0,0 +1,143 @@
+/**
+ * @file batch.hpp
+ * @brief Spreads many independent inputs (for instance, recordings to analyze) over a pool of threads.
+ * @see http://github.com/creaktive/pianolizer
+ * @author Stanislaw Pusep
+ * @copyright MIT
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+/**
+ * Runs a fixed set of tasks on a pool of threads, with work stealing: the tasks are dealt out to the workers
+ * upfront, the most expensive first, & each worker takes the next one from the front of its own queue;
+ * once it runs out, it steals from the back of the queue with the most tasks left.
+ * So the workers that drew the quick tasks help the others, without contending over one shared queue.
+ * The work function gets the worker index too, so that each worker can keep (& reuse) its own state.
+ *
+ * @class WorkStealingPool
+ * @par EXAMPLE
+ * WorkStealingPool pool;
+ * std::vector<std::unique_ptr<SlidingDFT>> analyzers(pool.threads);
+ * pool.run(fileSizes, [&](const unsigned worker, const size_t file) {
+ *   if (analyzers[worker] == nullptr)
+ *     analyzers[worker] = std::make_unique<SlidingDFT>(tuning);
+ *   else
+ *     analyzers[worker]->reset();
+ *   // analyze the file
+ * });
+ */
+class WorkStealingPool {
+  private:
+    struct Queue {
+      std::mutex mutex;
+      std::deque<size_t> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+
+    bool take(const unsigned worker, size_t& task) {
+      Queue& own = *queues[worker];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (own.tasks.empty())
+        return false;
+      task = own.tasks.front();
+      own.tasks.pop_front();
+      return true;
+    }
+
+    bool steal(const unsigned worker, size_t& task) {
+      // nothing gets queued after run() started, so the sizes only go down; a stale pick just means another round
+      for (;;) {
+        unsigned victim = worker;
+        size_t most = 0;
+        for (unsigned i = 0; i < queues.size(); i++) {
+          std::lock_guard<std::mutex> lock(queues[i]->mutex);
+          if (i != worker && queues[i]->tasks.size() > most) {
+            most = queues[i]->tasks.size();
+            victim = i;
+          }
+        }
+        if (victim == worker)
+          return false;
+
+        Queue& other = *queues[victim];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (other.tasks.empty())
+          continue;
+        task = other.tasks.back();
+        other.tasks.pop_back();
+        steals++;
+        return true;
+      }
+    }
+
+  public:
+    const unsigned threads;
+    std::atomic<unsigned long> steals;
+
+    /**
+     * Creates an instance of WorkStealingPool.
+     * @param [threads_=0] Number of worker threads; 0 means one per CPU core.
+     * @memberof WorkStealingPool
+     */
+    WorkStealingPool(const unsigned threads_ = 0)
+      : threads(threads_ > 0 ? threads_ : std::max(std::thread::hardware_concurrency(), 1u)), steals(0) {
+      for (unsigned i = 0; i < threads; i++)
+        queues.push_back(std::make_unique<Queue>());
+    }
+
+    /**
+     * Runs every task once & waits for all of them to finish.
+     * When a task throws, the remaining tasks still run; the first exception is rethrown at the end.
+     *
+     * @param costs Expected cost of each task (for instance, the file size); only the order matters.
+     * @param work Function of the worker index (from 0 to threads - 1) & the task index (of costs).
+     * @memberof WorkStealingPool
+     */
+    void run(const std::vector<double>& costs, const std::function<void(unsigned, size_t)>& work) {
+      std::vector<size_t> order(costs.size());
+      std::iota(order.begin(), order.end(), 0);
+      std::stable_sort(order.begin(), order.end(), [&costs](const size_t a, const size_t b) {
+        return costs[a] > costs[b];
+      });
+      for (size_t i = 0; i < order.size(); i++)
+        queues[i % threads]->tasks.push_back(order[i]);
+
+      std::mutex errorMutex;
+      std::exception_ptr error;
+      auto worker = [&](const unsigned index) {
+        size_t task;
+        while (take(index, task) || steal(index, task)) {
+          try {
+            work(index, task);
+          } catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (error == nullptr)
+              error = std::current_exception();
+          }
+        }
+      };
+
+      std::vector<std::thread> pool;
+      for (unsigned index = 1; index < threads; index++)
+        pool.emplace_back(worker, index);
+      worker(0);
+      for (auto& thread : pool)
+        thread.join();
+
+      if (error != nullptr)
+        std::rethrow_exception(error);
+    }
+};
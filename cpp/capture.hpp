@@ -0,0 +1,196 @@
+/**
+ * @file capture.hpp
+ * @brief Records the raw input as it arrived (the samples, the block boundaries & the timing) & plays it back.
+ * @see http://github.com/creaktive/pianolizer
+ * @author Stanislaw Pusep
+ * @copyright MIT
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// the samples are stored as they are in memory
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "the capture files are little-endian");
+
+/**
+ * Layout of the capture file (all little-endian):
+ *
+ * header:   "PNLZCAPT", u32 version, u32 channels, u32 sampleRate, u32 blockFrames
+ * blocks:   u32 values, u32 interval, then values * f32 (interleaved samples)
+ *
+ * One block per read of the input, of whatever size that read returned (up to blockFrames * channels values);
+ * the interval is the time since the previous block arrived (since the start, for the first one), in microseconds.
+ * That is 8 bytes per block on top of the samples. There is no trailer: the file can be read while it is being
+ * written, or after a crash; an incomplete last block is ignored.
+ *
+ * @class CaptureFormat
+ */
+class CaptureFormat {
+  public:
+    static const char* magic() {
+      return "PNLZCAPT";
+    }
+
+    static constexpr uint32_t version = 1;
+};
+
+/**
+ * Appends the input blocks to a capture file, as they arrive.
+ *
+ * @class CaptureWriter
+ * @par EXAMPLE
+ * CaptureWriter capture("field.pnlzcap", 1, 44100, 256, microseconds());
+ * // for every read of the input
+ * const size_t len = fread(buffer, sizeof(float), 256, stdin);
+ * capture.write(buffer, len, microseconds());
+ */
+class CaptureWriter {
+  private:
+    FILE *file = nullptr;
+    uint64_t last = 0;
+
+    void put(const void *data, const size_t length) {
+      if (fwrite(data, 1, length, file) != length)
+        throw std::runtime_error(std::string("fwrite: ") + strerror(errno));
+    }
+
+  public:
+    unsigned long blocks = 0;
+
+    /**
+     * Creates (or truncates) the capture file & writes the header.
+     * @param path File name.
+     * @param channels Number of interleaved channels.
+     * @param sampleRate Sample rate.
+     * @param blockFrames Largest block, in frames (the -b buffer size).
+     * @param [start=0] Time the capture starts at, in microseconds (for the interval of the first block).
+     * @memberof CaptureWriter
+     */
+    CaptureWriter(const std::string& path, const unsigned channels, const unsigned sampleRate, const unsigned blockFrames, const uint64_t start = 0)
+      : last(start) {
+      if ((file = fopen(path.c_str(), "wb")) == nullptr)
+        throw std::runtime_error("fopen " + path + ": " + strerror(errno));
+      const uint32_t header[] = { CaptureFormat::version, channels, sampleRate, blockFrames };
+      put(CaptureFormat::magic(), 8);
+      put(header, sizeof(header));
+    }
+
+    CaptureWriter(const CaptureWriter&) = delete;
+    CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+    ~CaptureWriter() {
+      if (file != nullptr)
+        fclose(file);
+    }
+
+    /**
+     * Appends one block.
+     *
+     * @param samples Interleaved samples.
+     * @param values Number of samples (of all channels together), as returned by the read.
+     * @param time When the block arrived, in microseconds, on the same clock as the start.
+     * @memberof CaptureWriter
+     */
+    void write(const float samples[], const size_t values, const uint64_t time) {
+      const uint32_t header[] = {
+        static_cast<uint32_t>(values),
+        static_cast<uint32_t>(std::min(time - last, static_cast<uint64_t>(UINT32_MAX)))
+      };
+      last = time;
+      put(header, sizeof(header));
+      put(samples, values * sizeof(float));
+      blocks++;
+    }
+
+    /**
+     * Writes whatever is still buffered out.
+     *
+     * @memberof CaptureWriter
+     */
+    void flush() {
+      if (fflush(file) != 0)
+        throw std::runtime_error(std::string("fflush: ") + strerror(errno));
+    }
+};
+
+/**
+ * Reads the blocks of a capture file back, in order, with the same boundaries & the time each one arrived at.
+ *
+ * @class CaptureReader
+ * @par EXAMPLE
+ * CaptureReader capture("field.pnlzcap");
+ * std::vector<float> buffer(capture.blockFrames * capture.channels);
+ * size_t values;
+ * while ((values = capture.read(buffer.data())) > 0)
+ *   ; // process the block; it arrived capture.time microseconds after the start
+ */
+class CaptureReader {
+  private:
+    FILE *file = nullptr;
+
+  public:
+    unsigned channels, sampleRate, blockFrames;
+    uint64_t time = 0; // arrival of the last block read, in microseconds since the start of the capture
+    unsigned long blocks = 0;
+
+    /**
+     * Opens the capture file & reads the header.
+     * @param path File name.
+     * @memberof CaptureReader
+     */
+    CaptureReader(const std::string& path) {
+      if ((file = fopen(path.c_str(), "rb")) == nullptr)
+        throw std::runtime_error("fopen " + path + ": " + strerror(errno));
+      char magic[8];
+      uint32_t header[4];
+      if (fread(magic, 1, sizeof(magic), file) != sizeof(magic)
+        || memcmp(magic, CaptureFormat::magic(), sizeof(magic)) != 0
+        || fread(header, 1, sizeof(header), file) != sizeof(header)
+      ) {
+        fclose(file);
+        throw std::runtime_error("not a capture file: " + path);
+      }
+      if (header[0] != CaptureFormat::version || header[1] == 0 || header[3] == 0) {
+        fclose(file);
+        throw std::runtime_error("unsupported capture file: " + path);
+      }
+      channels = header[1];
+      sampleRate = header[2];
+      blockFrames = header[3];
+    }
+
+    CaptureReader(const CaptureReader&) = delete;
+    CaptureReader& operator=(const CaptureReader&) = delete;
+
+    ~CaptureReader() {
+      fclose(file);
+    }
+
+    /**
+     * Reads the next block.
+     *
+     * @param samples Room for blockFrames * channels floats.
+     * @return Number of samples (of all channels together) in the block; 0 at the end of the capture.
+     * @memberof CaptureReader
+     */
+    size_t read(float samples[]) {
+      uint32_t header[2];
+      if (fread(header, 1, sizeof(header), file) != sizeof(header))
+        return 0;
+      const size_t values = header[0];
+      if (values > static_cast<size_t>(blockFrames) * channels)
+        throw std::runtime_error("corrupt capture file: block of " + std::to_string(values) + " samples");
+      if (fread(samples, sizeof(float), values, file) != values)
+        return 0;
+      time += header[1];
+      blocks++;
+      return values;
+    }
+};
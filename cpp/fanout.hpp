@@ -0,0 +1,369 @@
+/**
+ * @file fanout.hpp
+ * @brief Broadcasts the analyzer frames to many local subscribers (Linux-specific; uses epoll).
+ * @see http://github.com/creaktive/pianolizer
+ * @author Stanislaw Pusep
+ * @copyright MIT
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * Non-blocking server that sends every frame to every connected client.
+ * Each client has its own bounded queue: a client that does not keep up loses the *oldest*
+ * pending frames, so the analysis never stalls. A client in the "latest" mode only ever gets the
+ * most recent frame (the one being sent at the moment is always completed, so the stream stays framed).
+ * Clients can switch their own mode by sending the line "latest" or "queue".
+ *
+ * @class FanOutServer
+ * @par EXAMPLE
+ * FanOutServer server("unix:/tmp/pianolizer.sock", 16);
+ * // for every frame
+ * server.broadcast(frame);
+ * // accept the new clients & flush the pending frames; never blocks
+ * server.poll();
+ * // or, while waiting for the input, keep serving the clients
+ * server.serveUntilReadable(STDIN_FILENO);
+ */
+class FanOutServer {
+  private:
+    struct Client {
+      std::deque<std::shared_ptr<const std::string>> queue;
+      size_t offset = 0; // how much of the queue front was already sent
+      bool latest;
+      bool writable = true;
+      unsigned long sent = 0, dropped = 0;
+      std::string command;
+    };
+
+    int listenFd = -1;
+    int epollFd = -1;
+    std::string unixPath;
+    std::map<int, Client> clients;
+
+    static void setNonBlocking(const int fd) {
+      const int flags = fcntl(fd, F_GETFL, 0);
+      if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+        throw std::runtime_error(std::string("fcntl: ") + strerror(errno));
+    }
+
+    void listenUnix(const std::string& path) {
+      sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      if (path.size() >= sizeof(addr.sun_path))
+        throw std::invalid_argument("socket path too long: " + path);
+      strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+      // a stale socket of a previous run is replaced; anything else at that path is left alone
+      struct stat status;
+      if (lstat(path.c_str(), &status) == 0) {
+        if (!S_ISSOCK(status.st_mode))
+          throw std::runtime_error("bind " + path + ": address in use (not a socket)");
+        unlink(path.c_str());
+      }
+      if ((listenFd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+        throw std::runtime_error(std::string("socket: ") + strerror(errno));
+      if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1)
+        throw std::runtime_error("bind " + path + ": " + strerror(errno));
+      unixPath = path;
+    }
+
+    void listenTCP(const std::string& hostPort) {
+      const size_t colon = hostPort.rfind(':');
+      std::string host = colon == std::string::npos ? "" : hostPort.substr(0, colon);
+      const std::string port = colon == std::string::npos ? hostPort : hostPort.substr(colon + 1);
+      if (host.size() > 1 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+
+      addrinfo hints;
+      memset(&hints, 0, sizeof(hints));
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      hints.ai_flags = AI_PASSIVE;
+      addrinfo *result = nullptr;
+      const int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+      if (error != 0)
+        throw std::invalid_argument("getaddrinfo " + hostPort + ": " + gai_strerror(error));
+
+      std::string lastError = "no address";
+      for (addrinfo *ai = result; ai != nullptr; ai = ai->ai_next) {
+        if ((listenFd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) == -1) {
+          lastError = strerror(errno);
+          continue;
+        }
+        const int yes = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if (bind(listenFd, ai->ai_addr, ai->ai_addrlen) == 0)
+          break;
+        lastError = strerror(errno);
+        close(listenFd);
+        listenFd = -1;
+      }
+      freeaddrinfo(result);
+      if (listenFd == -1)
+        throw std::runtime_error("bind " + hostPort + ": " + lastError);
+    }
+
+    void watch(const int fd, const uint32_t events, const int op) {
+      epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = events;
+      event.data.fd = fd;
+      if (epoll_ctl(epollFd, op, fd, &event) == -1)
+        throw std::runtime_error(std::string("epoll_ctl: ") + strerror(errno));
+    }
+
+    void accept() {
+      for (;;) {
+        const int fd = ::accept(listenFd, nullptr, nullptr);
+        if (fd == -1) {
+          if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED || errno == EINTR)
+            return;
+          throw std::runtime_error(std::string("accept: ") + strerror(errno));
+        }
+        setNonBlocking(fd);
+        const int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes)); // fails harmlessly on UNIX sockets
+        watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+        clients[fd].latest = queueDepth == 0;
+      }
+    }
+
+    void disconnect(const int fd) {
+      epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+      close(fd);
+      clients.erase(fd);
+    }
+
+    // reads the mode switching commands; returns false when the client is gone
+    bool receive(const int fd, Client& client) {
+      char buffer[256];
+      for (;;) {
+        const ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+        if (len == 0)
+          return false;
+        if (len < 0)
+          return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+        for (ssize_t i = 0; i < len; i++) {
+          if (buffer[i] == '\n' || buffer[i] == '\r') {
+            if (client.command == "latest")
+              client.latest = true;
+            else if (client.command == "queue")
+              client.latest = false;
+            client.command.clear();
+          } else if (client.command.size() < 16) {
+            client.command += buffer[i];
+          }
+        }
+      }
+    }
+
+    // sends as much as the socket takes; returns false when the client is gone
+    bool flush(const int fd, Client& client) {
+      while (!client.queue.empty()) {
+        const std::string& frame = *client.queue.front();
+        const ssize_t len = send(fd, frame.data() + client.offset, frame.size() - client.offset, MSG_NOSIGNAL);
+        if (len < 0) {
+          if (errno == EINTR)
+            continue;
+          if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return false;
+          if (client.writable) {
+            client.writable = false;
+            watch(fd, EPOLLIN | EPOLLOUT, EPOLL_CTL_MOD);
+          }
+          return true;
+        }
+
+        client.offset += static_cast<size_t>(len);
+        if (client.offset == frame.size()) {
+          client.queue.pop_front();
+          client.offset = 0;
+          client.sent++;
+        }
+      }
+
+      if (!client.writable) {
+        client.writable = true;
+        watch(fd, EPOLLIN, EPOLL_CTL_MOD);
+      }
+      return true;
+    }
+
+  public:
+    unsigned queueDepth;
+
+    struct ClientStats {
+      int fd;
+      bool latest;
+      size_t queued;
+      unsigned long sent, dropped;
+    };
+
+    /**
+     * Creates an instance of FanOutServer.
+     * @param address "unix:/path/to.sock" (UNIX socket), "host:port", "[v6addr]:port" or just "port" (TCP).
+     * @param queueDepth_ Frames kept per client before the oldest get dropped; 0 makes every client "latest" by default.
+     * @memberof FanOutServer
+     */
+    FanOutServer(const std::string& address, const unsigned queueDepth_ = 16)
+      : queueDepth(queueDepth_) {
+      if (address.compare(0, 5, "unix:") == 0)
+        listenUnix(address.substr(5));
+      else
+        listenTCP(address);
+
+      setNonBlocking(listenFd);
+      if (listen(listenFd, SOMAXCONN) == -1)
+        throw std::runtime_error(std::string("listen: ") + strerror(errno));
+      if ((epollFd = epoll_create1(0)) == -1)
+        throw std::runtime_error(std::string("epoll_create1: ") + strerror(errno));
+      watch(listenFd, EPOLLIN, EPOLL_CTL_ADD);
+    }
+
+    FanOutServer(const FanOutServer&) = delete;
+    FanOutServer& operator=(const FanOutServer&) = delete;
+
+    ~FanOutServer() {
+      for (auto& kv : clients)
+        close(kv.first);
+      if (epollFd != -1)
+        close(epollFd);
+      if (listenFd != -1)
+        close(listenFd);
+      if (!unixPath.empty())
+        unlink(unixPath.c_str());
+    }
+
+    /**
+     * Handles the pending connections, commands & writes.
+     *
+     * @param [timeout=0] Milliseconds to wait for an event; 0 returns immediately.
+     * @memberof FanOutServer
+     */
+    void poll(const int timeout = 0) {
+      epoll_event events[64];
+      const int ready = epoll_wait(epollFd, events, 64, timeout);
+      if (ready < 0) {
+        if (errno == EINTR)
+          return;
+        throw std::runtime_error(std::string("epoll_wait: ") + strerror(errno));
+      }
+
+      for (int i = 0; i < ready; i++) {
+        const int fd = events[i].data.fd;
+        if (fd == listenFd) {
+          accept();
+          continue;
+        }
+
+        auto it = clients.find(fd);
+        if (it == clients.end())
+          continue;
+        bool alive = !(events[i].events & (EPOLLERR | EPOLLHUP));
+        if (alive && (events[i].events & EPOLLIN))
+          alive = receive(fd, it->second);
+        if (alive && (events[i].events & EPOLLOUT))
+          alive = flush(fd, it->second);
+        if (!alive)
+          disconnect(fd);
+      }
+    }
+
+    /**
+     * Keeps handling the connections, commands & writes until the given descriptor becomes readable,
+     * so that the clients are still served while the input stalls.
+     *
+     * @param fd Descriptor to wait for (for instance, the unbuffered stdin).
+     * @return false when a signal interrupted the wait; the caller decides whether to wait again.
+     * @memberof FanOutServer
+     */
+    bool serveUntilReadable(const int fd) {
+      pollfd fds[2];
+      fds[0] = { fd, POLLIN, 0 };
+      fds[1] = { epollFd, POLLIN, 0 };
+      for (;;) {
+        if (::poll(fds, 2, -1) == -1) {
+          if (errno == EINTR)
+            return false;
+          throw std::runtime_error(std::string("poll: ") + strerror(errno));
+        }
+        if (fds[1].revents != 0)
+          poll();
+        if (fds[0].revents != 0)
+          return true;
+      }
+    }
+
+    /**
+     * Queues the frame for every client & sends right away whatever the sockets take.
+     *
+     * @param frame Serialized frame (a hex line or a binary record).
+     * @memberof FanOutServer
+     */
+    void broadcast(const std::string& frame) {
+      auto shared = std::make_shared<const std::string>(frame);
+      std::vector<int> gone;
+
+      for (auto& kv : clients) {
+        Client& client = kv.second;
+        // the partially sent front frame is never dropped, or the stream would lose the framing
+        const size_t keep = client.offset > 0 ? 1 : 0;
+        const size_t limit = client.latest ? keep : keep + (queueDepth > 0 ? queueDepth - 1 : 0);
+        while (client.queue.size() > limit) {
+          client.queue.erase(client.queue.begin() + static_cast<long>(keep));
+          client.dropped++;
+        }
+        client.queue.push_back(shared);
+
+        if (client.writable && !flush(kv.first, client))
+          gone.push_back(kv.first);
+      }
+
+      for (const int fd : gone)
+        disconnect(fd);
+    }
+
+    /**
+     * Number of connected clients.
+     *
+     * @memberof FanOutServer
+     */
+    size_t size() const {
+      return clients.size();
+    }
+
+    /**
+     * Per-client counters.
+     *
+     * @memberof FanOutServer
+     */
+    std::vector<ClientStats> stats() const {
+      std::vector<ClientStats> output;
+      for (auto& kv : clients)
+        output.push_back({ kv.first, kv.second.latest, kv.second.queue.size(), kv.second.sent, kv.second.dropped });
+      return output;
+    }
+};
@@ -0,0 +1,156 @@
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "libpianolizer.h"
+#include "pianolizer.hpp"
+
+struct pianolizer {
+  unsigned channels;
+  std::shared_ptr<Tuning> tuning;
+  std::vector<Tuning::tuningValues> mapping;
+  std::unique_ptr<SlidingDFT> slidingDFT;
+  std::vector<float> input;
+  std::vector<float> silence;
+  const float *levels;
+};
+
+// the first version of pianolizer_config_t ended with max_average_window
+static const size_t configMinSize = offsetof(pianolizer_config_t, max_average_window) + sizeof(double);
+
+static thread_local std::string lastError;
+
+static void setError(const char *message) {
+  lastError = message;
+}
+
+void pianolizer_config_init(pianolizer_config_t *config) {
+  if (config == nullptr)
+    return;
+  config->struct_size = sizeof(pianolizer_config_t);
+  config->sample_rate = 44100;
+  config->channels = 1;
+  config->keys = 61;
+  config->reference_key = 33;
+  config->pitch_fork = 440.;
+  config->tolerance = 1.;
+  config->max_average_window = -1.;
+}
+
+pianolizer_t *pianolizer_create(const pianolizer_config_t *callerConfig) {
+  try {
+    if (callerConfig == nullptr)
+      throw std::invalid_argument("config is NULL");
+    if (callerConfig->struct_size < configMinSize || callerConfig->struct_size > sizeof(pianolizer_config_t))
+      throw std::invalid_argument("config->struct_size does not match this library; was the config initialized with pianolizer_config_init()?");
+    // an older caller passes a shorter config: the fields it does not know keep their defaults
+    pianolizer_config_t effective;
+    pianolizer_config_init(&effective);
+    memcpy(&effective, callerConfig, callerConfig->struct_size);
+    const pianolizer_config_t *config = &effective;
+    if (config->sample_rate == 0 || config->channels == 0 || config->keys == 0)
+      throw std::invalid_argument("sample_rate, channels & keys must be positive");
+    if (config->tolerance <= 0. || config->tolerance > 1.)
+      throw std::invalid_argument("tolerance must be in the range (0.0, 1.0]");
+
+    auto analyzer = std::make_unique<pianolizer>();
+    analyzer->channels = config->channels;
+    analyzer->tuning = std::make_shared<PianoTuning>(
+      config->sample_rate,
+      config->keys,
+      config->reference_key,
+      config->pitch_fork,
+      config->tolerance
+    );
+    analyzer->mapping = analyzer->tuning->mapping();
+    analyzer->slidingDFT = std::make_unique<SlidingDFT>(analyzer->tuning, config->max_average_window);
+    analyzer->silence.assign(config->keys, 0.);
+    analyzer->levels = analyzer->silence.data();
+    lastError.clear();
+    return analyzer.release();
+  } catch (std::exception const& e) {
+    setError(e.what());
+    return nullptr;
+  }
+}
+
+void pianolizer_destroy(pianolizer_t *analyzer) {
+  delete analyzer;
+}
+
+long pianolizer_process(
+  pianolizer_t *analyzer,
+  const float *samples,
+  size_t frames,
+  size_t block_size,
+  double average_window,
+  float *levels
+) {
+  if (analyzer == nullptr || (samples == nullptr && frames > 0) || levels == nullptr) {
+    setError("NULL argument");
+    return -1;
+  }
+  if (block_size == 0) {
+    setError("block_size must be positive");
+    return -1;
+  }
+
+  try {
+    const unsigned channels = analyzer->channels;
+    const unsigned bands = analyzer->slidingDFT->bands;
+    analyzer->input.resize(block_size);
+    float *input = analyzer->input.data();
+
+    long rows = 0;
+    for (size_t offset = 0; offset < frames; offset += block_size) {
+      const size_t length = std::min(block_size, frames - offset);
+      const float *block = samples + offset * channels;
+
+      if (channels == 1) {
+        memcpy(input, block, sizeof(float) * length);
+      } else {
+        memset(input, 0, sizeof(float) * length);
+        for (size_t i = 0; i < length * channels; i++)
+          input[i / channels] += block[i];
+      }
+
+      analyzer->levels = analyzer->slidingDFT->process(input, length, average_window);
+      memcpy(levels + static_cast<size_t>(rows) * bands, analyzer->levels, sizeof(float) * bands);
+      rows++;
+    }
+    return rows;
+  } catch (std::exception const& e) {
+    setError(e.what());
+    return -1;
+  }
+}
+
+unsigned pianolizer_bands(const pianolizer_t *analyzer) {
+  return analyzer != nullptr ? analyzer->slidingDFT->bands : 0;
+}
+
+unsigned pianolizer_sample_rate(const pianolizer_t *analyzer) {
+  return analyzer != nullptr ? analyzer->slidingDFT->sampleRate : 0;
+}
+
+void pianolizer_mapping(const pianolizer_t *analyzer, unsigned *k, unsigned *n) {
+  if (analyzer == nullptr)
+    return;
+  unsigned band = 0;
+  for (auto values : analyzer->mapping) {
+    if (k != nullptr)
+      k[band] = values.k;
+    if (n != nullptr)
+      n[band] = values.N;
+    band++;
+  }
+}
+
+const float *pianolizer_levels(const pianolizer_t *analyzer) {
+  return analyzer != nullptr ? analyzer->levels : nullptr;
+}
+
+const char *pianolizer_error(void) {
+  return lastError.c_str();
+}
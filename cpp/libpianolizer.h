@@ -0,0 +1,106 @@
+/**
+ * @file libpianolizer.h
+ * @brief C ABI for the pianolizer library (libpianolizer.so), for in-process use from C, Python (ctypes/cffi), Rust & co.
+ * @see http://github.com/creaktive/pianolizer
+ * @author Stanislaw Pusep
+ * @copyright MIT
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/* the shared library is built with -fvisibility=hidden; only the C ABI below gets exported */
+#ifndef PIANOLIZER_API
+#define PIANOLIZER_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Opaque analyzer handle.
+ */
+typedef struct pianolizer pianolizer_t;
+
+/**
+ * Analyzer configuration; always initialize with pianolizer_config_init() first,
+ * so that the fields added in the future get sane defaults.
+ * New fields only ever get appended: struct_size tells the library which ones the caller knows about,
+ * and the ones past it take their defaults.
+ */
+typedef struct pianolizer_config {
+  size_t struct_size;         /* sizeof(pianolizer_config_t) the caller was compiled with; set by pianolizer_config_init() */
+  unsigned sample_rate;       /* default: 44100 (Hz) */
+  unsigned channels;          /* interleaved input channels, mixed down by summing; default: 1 */
+  unsigned keys;              /* number of keys on the piano keyboard; default: 61 */
+  unsigned reference_key;     /* reference key index (A4); default: 33 */
+  double pitch_fork;          /* A4 reference frequency; default: 440 (Hz) */
+  double tolerance;           /* frequency tolerance, range (0.0, 1.0]; default: 1 */
+  double max_average_window;  /* > 0: HeavyMovingAverage of this size (seconds); < 0: FastMovingAverage; 0: no averaging; default: -1 */
+} pianolizer_config_t;
+
+/**
+ * Fills the configuration with the default values, struct_size included.
+ */
+PIANOLIZER_API void pianolizer_config_init(pianolizer_config_t *config);
+
+/**
+ * Creates an analyzer.
+ * @return NULL on failure (including a struct_size this library does not know); see pianolizer_error().
+ */
+PIANOLIZER_API pianolizer_t *pianolizer_create(const pianolizer_config_t *config);
+
+/**
+ * Releases the analyzer. NULL is ignored.
+ */
+PIANOLIZER_API void pianolizer_destroy(pianolizer_t *analyzer);
+
+/**
+ * Processes the samples in blocks, emitting one row of levels per block.
+ * @param samples Interleaved 32-bit float PCM, frames * channels values.
+ * @param frames Number of frames in samples.
+ * @param block_size Frames per block (per output row); the last block may be shorter.
+ * @param average_window Moving average window, in seconds.
+ * @param levels Output matrix, row-major, with at least ceil(frames / block_size) * pianolizer_bands() values.
+ * @return Number of rows written, or -1 on failure; see pianolizer_error().
+ */
+PIANOLIZER_API long pianolizer_process(
+  pianolizer_t *analyzer,
+  const float *samples,
+  size_t frames,
+  size_t block_size,
+  double average_window,
+  float *levels
+);
+
+/**
+ * Number of bands (columns of the levels matrix).
+ */
+PIANOLIZER_API unsigned pianolizer_bands(const pianolizer_t *analyzer);
+
+/**
+ * Sample rate the analyzer was configured with.
+ */
+PIANOLIZER_API unsigned pianolizer_sample_rate(const pianolizer_t *analyzer);
+
+/**
+ * Copies the k & N values of each band (pianolizer_bands() values each).
+ * Either pointer may be NULL.
+ */
+PIANOLIZER_API void pianolizer_mapping(const pianolizer_t *analyzer, unsigned *k, unsigned *n);
+
+/**
+ * Levels after the most recently processed block (pianolizer_bands() values), owned by the analyzer.
+ */
+PIANOLIZER_API const float *pianolizer_levels(const pianolizer_t *analyzer);
+
+/**
+ * Description of the last failure in the calling thread; empty string if none.
+ */
+PIANOLIZER_API const char *pianolizer_error(void);
+
+#ifdef __cplusplus
+}
+#endif
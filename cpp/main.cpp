@@ -1,15 +1,334 @@
+#include <algorithm>
+#include <chrono>
 #include <climits>
 #include <cstring>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <sstream>
+#include <thread>
+#include <dirent.h>
 #include <getopt.h>
+#include <signal.h>
 #include <stdio.h>
+#include <sys/stat.h>
 
+#include "batch.hpp"
+#include "capture.hpp"
+#include "fanout.hpp"
 #include "pianolizer.hpp"
+#include "realtime.hpp"
+#include "sharedframe.hpp"
+#include "sharedring.hpp"
+#include "spectrogram.hpp"
 
 using namespace std;
 
+// parses "FROM:TO"; either side may be omitted, keeping the default
+void parseRange(const char *range, double& from, double& to);
+void parseRange(const char *range, double& from, double& to) {
+  const char *colon = strchr(range, ':');
+  if (colon == nullptr) {
+    from = atof(range);
+    return;
+  }
+  if (colon != range)
+    from = atof(range);
+  if (colon[1] != '\0')
+    to = atof(colon + 1);
+}
+
+// prints the frames of an archive (see SpectrogramWriter) in the same formats as the live output
+int decodeArchive(const string& path, double from, double to, double firstKey, double lastKey, bool decimal, bool binary);
+int decodeArchive(const string& path, double from, double to, double firstKey, double lastKey, bool decimal, bool binary) {
+  SpectrogramReader reader(path);
+  const unsigned firstBand = static_cast<unsigned>(max(0., firstKey));
+  const unsigned lastBand = static_cast<unsigned>(min(lastKey, reader.bands - 1.));
+  if (firstBand > lastBand) {
+    cerr << "no such keys in " << path << endl;
+    return EXIT_FAILURE;
+  }
+  const unsigned bandCount = lastBand - firstBand + 1;
+
+  const uint64_t firstFrame = reader.frameAt(from);
+  const uint64_t endFrame = to < 0. ? reader.frames : reader.frameAt(to);
+  const uint64_t framesPerRead = 1024;
+  vector<uint8_t> values(framesPerRead * bandCount);
+  for (uint64_t frame = firstFrame; frame < endFrame; frame += framesPerRead) {
+    const uint64_t count = reader.read(frame, min(framesPerRead, endFrame - frame), firstBand, bandCount, values.data());
+    stringstream stream;
+    for (uint64_t row = 0; row < count; row++) {
+      const uint8_t *value = values.data() + row * bandCount;
+      if (binary) {
+        stream.write(reinterpret_cast<const char*>(value), static_cast<streamsize>(bandCount));
+        continue;
+      }
+      for (unsigned i = 0; i < bandCount; i++) {
+        if (decimal)
+          stream << (i > 0 ? " " : "") << value[i] / 255.;
+        else
+          stream << setfill('0') << setw(2) << hex << static_cast<unsigned>(value[i]);
+      }
+      stream << '\n';
+    }
+    cout << stream.str();
+  }
+  cout << flush;
+  return EXIT_SUCCESS;
+}
+
+// copies the input into a shared ring, for the analyzers attached with -z
+int captureToRing(const string& name, size_t samples, size_t channels, int sampleRate);
+int captureToRing(const string& name, size_t samples, size_t channels, int sampleRate) {
+  SharedRingWriter ring(name, static_cast<unsigned>(channels), static_cast<unsigned>(sampleRate));
+  if (samples > ring.capacity())
+    samples = ring.capacity();
+
+  // let the ring be closed & unlinked on the way out
+  Interrupt::install();
+
+  auto stdin_handle = freopen(nullptr, "rb", stdin);
+  if (ferror(stdin_handle))
+    throw runtime_error(strerror(errno));
+  size_t len;
+  while (!Interrupt::requested() && (len = fread(ring.claim(samples), sizeof(float) * channels, samples, stdin_handle)) > 0)
+    ring.publish(len);
+  if (ferror(stdin_handle) && !Interrupt::requested())
+    throw runtime_error(strerror(errno));
+  return EXIT_SUCCESS;
+}
+
+// one output frame: hex, decimals (-d) or bytes (-e), with the pitch of each key (-P) appended when given
+void serializeFrame(ostream& stream, OutputTransform& transform, const float *output, const float *cents,
+  const bool decimal, const bool binary, vector<float>& valuesFloat, vector<uint8_t>& valuesInt);
+void serializeFrame(ostream& stream, OutputTransform& transform, const float *output, const float *cents,
+  const bool decimal, const bool binary, vector<float>& valuesFloat, vector<uint8_t>& valuesInt) {
+  const unsigned bands = valuesFloat.size();
+  if (decimal) {
+    transform.apply(output, valuesFloat.data());
+    for (unsigned i = 0; i < bands; i++) {
+      stream << valuesFloat[i];
+      if (i < bands - 1)
+        stream << ' ';
+    }
+  } else {
+    transform.apply(output, valuesInt.data());
+    if (binary)
+      stream.write(reinterpret_cast<const char*>(valuesInt.data()), static_cast<streamsize>(bands));
+    else
+      for (unsigned i = 0; i < bands; i++)
+        stream << setfill('0') << setw(2) << hex << static_cast<unsigned>(valuesInt[i]);
+  }
+  if (cents != nullptr) {
+    // one more value per key: tenths of a cent as decimals, or whole cents offset by 128 as bytes;
+    // the keys silenced by the noise gate have no pitch
+    for (unsigned i = 0; i < bands; i++) {
+      const bool audible = decimal ? valuesFloat[i] > 0.f : valuesInt[i] > 0;
+      const float value = audible ? cents[i] : 0.f;
+      if (decimal) {
+        stream << ' ' << std::round(value * 10.f) / 10.f;
+        continue;
+      }
+      const uint8_t byte = static_cast<uint8_t>(min(max(std::round(value) + 128.f, 0.f), 255.f));
+      if (binary)
+        stream.write(reinterpret_cast<const char*>(&byte), 1);
+      else
+        stream << setfill('0') << setw(2) << hex << static_cast<unsigned>(byte);
+    }
+  }
+  if (!binary)
+    stream << '\n';
+}
+
+// the settings of the analysis that apply to the batch mode
+struct BatchOptions {
+  size_t samples, channels;
+  int sampleRate;
+  float pitchFork, averageWindow, threshold;
+  int keys, refKey;
+  double tolerance;
+  bool quickBass;
+  unsigned pitchSpan;
+  bool squareRoot, decibels, decimal, binary;
+  string outputDirectory;
+  unsigned threads;
+};
+
+// the results of the previous runs are not inputs
+const char *resultSuffix(const bool decimal, const bool binary);
+const char *resultSuffix(const bool decimal, const bool binary) {
+  return decimal ? ".txt" : binary ? ".u8" : ".hex";
+}
+
+bool isResult(const string& name);
+bool isResult(const string& name) {
+  for (const char *suffix : { ".hex", ".txt", ".u8" }) {
+    const size_t length = strlen(suffix);
+    if (name.size() > length && name.compare(name.size() - length, length, suffix) == 0)
+      return true;
+  }
+  return false;
+}
+
+// every regular file in the directory (except for the hidden ones & the results), or every line of the list file
+vector<string> listInputs(const string& path);
+vector<string> listInputs(const string& path) {
+  vector<string> inputs;
+  DIR *directory = opendir(path.c_str());
+  if (directory == nullptr) {
+    if (errno != ENOTDIR)
+      throw runtime_error(path + ": " + strerror(errno));
+    ifstream list(path);
+    string line;
+    while (getline(list, line))
+      if (!line.empty())
+        inputs.push_back(line);
+    return inputs;
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(directory)) != nullptr) {
+    const string name = entry->d_name;
+    const string file = path + "/" + name;
+    struct stat status;
+    if (name.front() != '.' && !isResult(name) && stat(file.c_str(), &status) == 0 && S_ISREG(status.st_mode))
+      inputs.push_back(file);
+  }
+  closedir(directory);
+  sort(inputs.begin(), inputs.end());
+  return inputs;
+}
+
+// what each worker of the batch keeps from one file to the next: the analysis is reset, not rebuilt
+struct BatchAnalyzer {
+  SlidingDFT sdft;
+  unique_ptr<HopDFT> hopDFT;
+  unique_ptr<OnsetBooster> booster;
+  unique_ptr<PitchTracker> tracker;
+  OutputTransform transform;
+  vector<float> buffer, input, valuesFloat;
+  vector<uint8_t> valuesInt;
+
+  BatchAnalyzer(const shared_ptr<PianoTuning>& tuning, const BatchOptions& options)
+    : sdft(tuning, -1.),
+      transform(
+        sdft.bands,
+        options.decibels
+          ? OutputTransform::DECIBELS
+          : options.squareRoot ? OutputTransform::SQUARE_ROOT : OutputTransform::LINEAR,
+        options.threshold
+      ),
+      buffer(options.samples * options.channels), input(options.samples),
+      valuesFloat(sdft.bands), valuesInt(sdft.bands) {
+    if (options.averageWindow == 0. && !options.quickBass && options.pitchSpan == 0 && HopDFT::preferred(tuning, options.samples))
+      hopDFT = make_unique<HopDFT>(tuning);
+    if (options.quickBass)
+      booster = make_unique<OnsetBooster>(sdft);
+    if (options.pitchSpan > 0)
+      tracker = make_unique<PitchTracker>(0, options.pitchSpan);
+  }
+
+  void reset() {
+    sdft.reset();
+    if (hopDFT != nullptr)
+      hopDFT->reset();
+    if (booster != nullptr)
+      booster->reset();
+    if (tracker != nullptr)
+      tracker->reset();
+  }
+
+  // returns the number of samples (per channel) analyzed
+  size_t analyze(const string& inputPath, const string& outputPath, const BatchOptions& options) {
+    unique_ptr<FILE, int (*)(FILE*)> in(fopen(inputPath.c_str(), "rb"), fclose);
+    if (in == nullptr)
+      throw runtime_error(inputPath + ": " + strerror(errno));
+    ofstream out(outputPath, ios::binary);
+    if (!out)
+      throw runtime_error(outputPath + ": " + strerror(errno));
+
+    size_t len, total = 0;
+    while ((len = fread(buffer.data(), sizeof(buffer[0]), buffer.size(), in.get())) > 0) {
+      fill(input.begin(), input.end(), 0.f);
+      for (unsigned i = 0; i < len; i++)
+        input[i / options.channels] += buffer[i];
+      total += len / options.channels;
+
+      const float *output = hopDFT != nullptr
+        ? hopDFT->process(input.data(), input.size())
+        : sdft.process(input.data(), input.size(), options.averageWindow);
+      if (booster != nullptr)
+        output = booster->update(sdft, static_cast<unsigned>(input.size()));
+      const float *cents = tracker != nullptr ? tracker->update(sdft, static_cast<unsigned>(input.size())) : nullptr;
+      serializeFrame(out, transform, output, cents, options.decimal, options.binary, valuesFloat, valuesInt);
+    }
+    if (ferror(in.get()))
+      throw runtime_error(inputPath + ": " + strerror(errno));
+    out.close();
+    if (!out)
+      throw runtime_error(outputPath + ": " + strerror(errno));
+    return total;
+  }
+};
+
+// analyzes every input into a result file of its own, spreading the inputs over a pool of threads
+int analyzeBatch(const string& path, const BatchOptions& options);
+int analyzeBatch(const string& path, const BatchOptions& options) {
+  const vector<string> inputs = listInputs(path);
+  vector<double> sizes;
+  for (const auto& input : inputs) {
+    struct stat status;
+    sizes.push_back(stat(input.c_str(), &status) == 0 ? static_cast<double>(status.st_size) : 0.);
+  }
+
+  // solved once, shared by all the workers
+  auto tuning = make_shared<PianoTuning>(
+    options.sampleRate,
+    options.keys,
+    options.refKey,
+    options.pitchFork,
+    options.tolerance
+  );
+
+  WorkStealingPool pool(options.threads);
+  vector<unique_ptr<BatchAnalyzer>> analyzers(pool.threads);
+  mutex errorMutex;
+  atomic<unsigned long> failed(0);
+  atomic<unsigned long long> analyzed(0);
+
+  const auto start = chrono::steady_clock::now();
+  pool.run(sizes, [&](const unsigned worker, const size_t index) {
+    const string& input = inputs[index];
+    string output = input;
+    if (!options.outputDirectory.empty()) {
+      const size_t slash = input.rfind('/');
+      output = options.outputDirectory + "/" + (slash == string::npos ? input : input.substr(slash + 1));
+    }
+    output += resultSuffix(options.decimal, options.binary);
+
+    try {
+      if (analyzers[worker] == nullptr)
+        analyzers[worker] = make_unique<BatchAnalyzer>(tuning, options);
+      else
+        analyzers[worker]->reset();
+      analyzed += analyzers[worker]->analyze(input, output, options);
+    } catch (exception const& e) {
+      failed++;
+      lock_guard<mutex> lock(errorMutex);
+      cerr << e.what() << endl;
+    }
+  });
+  const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  const double audio = static_cast<double>(analyzed) / options.sampleRate;
+  cerr << "batch: " << inputs.size() << " files (" << failed << " failed) on " << pool.threads << " threads ("
+    << pool.steals << " steals): " << fixed << setprecision(1) << audio << "s of audio in " << setprecision(3) << elapsed
+    << "s; " << setprecision(1) << (elapsed > 0. ? audio / elapsed : 0.) << "x real time, "
+    << (elapsed > 0. ? inputs.size() / elapsed : 0.) << " files/s" << endl;
+  return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 void help();
 void help() {
   cout << "Usage:" << endl;
@@ -26,22 +345,41 @@ void help() {
   cout << "\t-a\taverage window (effectively a low-pass filter for the output); default: 0.04 (seconds; 0 to disable)" << endl;
   cout << "\t-t\tnoise gate threshold, from 0 to 1; default: 0" << endl;
   cout << "\t-x\tfrequency tolerance, range (0.0, 1.0]; default: 1" << endl;
+  cout << "\t-g\tcalibrate -p from the sustained notes, retuning on the fly; default: false" << endl;
+  cout << "\t-P\tappend the fine pitch of each key, in cents, measured over this many blocks (1 is the most responsive); default: none" << endl;
+  cout << "\t-j\tlight the bass keys up at the onsets, before their (long) windows fill up; default: false" << endl;
   cout << "\t-y\treturn the square root of each value; default: false" << endl;
+  cout << "\t-v\treturn each value in decibels, mapping -60..0 dB to 0..1 (not with -y); default: false" << endl;
   cout << "\t-d\tserialize as space-separated decimals; default: hex" << endl;
+  cout << "\t-e\tserialize as binary, one byte per key (not with -d); default: hex" << endl;
+  cout << "\t-l\tlisten on a UNIX socket (unix:PATH) or TCP ([HOST:]PORT) and broadcast to all clients instead of stdout" << endl;
+  cout << "\t-q\tframes queued per client before the oldest get dropped; 0 sends only the latest; default: 16" << endl;
+  cout << "\t-S\tpublish only the latest frame (as floats) into a shared memory object with this name instead of stdout, for misc/sharedframe.py; default: none" << endl;
+  cout << "\t-A\tshed load when the processing falls behind real time (pitch tracking & calibration off, moving average off, top octaves off), restoring it when it catches up; default: false" << endl;
+  cout << "\t-m\treal-time mode: lock & pre-fault the memory, report the blocks that took longer than -b/-s; default: false" << endl;
+  cout << "\t-u\tpin the processing to this CPU core (implies -m); default: none" << endl;
+  cout << "\t-f\tSCHED_FIFO priority, from 1 to 99 (implies -m); default: none" << endl;
+  cout << "\t-o\talso record the output to a compact, seekable spectrogram archive file; default: none" << endl;
+  cout << "\t-i\tdecode a spectrogram archive file instead of analyzing the input (honors -d & -e); default: none" << endl;
+  cout << "\t-w\ttime range to decode with -i, START:END; default: whole file (seconds)" << endl;
+  cout << "\t-n\tkey range to decode with -i, FIRST:LAST; default: all keys" << endl;
+  cout << "\t-B\tanalyze every file in this directory (or listed in this file, one per line) instead of stdin, each into a file of its own named after it (.hex, .txt with -d, .u8 with -e); default: none" << endl;
+  cout << "\t-O\tdirectory for the -B results; default: next to each input" << endl;
+  cout << "\t-T\tnumber of -B worker threads; default: one per CPU core" << endl;
+  cout << "\t-Z\tcopy the input into a shared memory ring with this name instead of analyzing it; default: none" << endl;
+  cout << "\t-z\tanalyze the input from a shared memory ring with this name (set up by -Z; sets -c & -s) instead of stdin; default: none" << endl;
+  cout << "\t-C\talso record the raw input, as it arrives (block boundaries & timing included), to a capture file; default: none" << endl;
+  cout << "\t-R\tanalyze the input replayed from a capture file (sets -b, -c & -s) instead of stdin, at the pace it was recorded at; default: none" << endl;
+  cout << "\t-F\treplay -R as fast as possible; default: false" << endl;
   cout << endl;
   cout << "Description:" << endl;
   cout << "Consumes an audio stream (1 channel, 32-bit float PCM)" << endl;
   cout << "and emits the volume levels of 61 notes (from C2 to C7) as a hex string." << endl;
+  cout << "Clients of the -l server may send the line \"latest\" to only get the most recent frame," << endl;
+  cout << "or \"queue\" to go back to the queued delivery." << endl;
   exit(EXIT_SUCCESS);
 }
 
-// C++17's <algorithm> header has this already
-double clamp(double d, double min, double max);
-double clamp(double d, double min, double max) {
-  const double t = d < min ? min : d;
-  return t > max ? max : t;
-}
-
 int main(int argc, char *argv[]) {
   size_t samples = 256; // known to work on RPi3b
   size_t channels = 1;
@@ -52,11 +390,35 @@ int main(int argc, char *argv[]) {
   int refKey = 33;
   float threshold = 0.;
   double tolerance = 1.;
+  bool calibrate = false;
+  bool quickBass = false;
+  unsigned pitchSpan = 0;
   bool squareRoot = false;
+  bool decibels = false;
   bool decimal = false;
+  bool binary = false;
+  string listenAddress;
+  unsigned queueDepth = 16;
+  string frameOutput;
+  bool realTime = false;
+  bool adaptive = false;
+  int cpuCore = -1;
+  int fifoPriority = 0;
+  string archiveOutput;
+  string archiveInput;
+  double timeFrom = 0., timeTo = -1.;
+  double firstKey = 0., lastKey = UINT_MAX;
+  string ringOutput;
+  string ringInput;
+  string batchInput;
+  string batchOutput;
+  unsigned batchThreads = 0;
+  string captureOutput;
+  string captureInput;
+  bool fastReplay = false;
 
   for (;;) {
-    switch (getopt(argc, argv, "b:c:s:p:k:r:a:t:x:ydh")) {
+    switch (getopt(argc, argv, "b:c:s:p:k:r:a:t:x:gP:jyvdel:q:S:Amu:f:o:i:w:n:B:O:T:Z:z:C:R:Fh")) {
       case -1:
         break;
       case 'b':
@@ -86,12 +448,86 @@ int main(int argc, char *argv[]) {
       case 'x':
         if (optarg) tolerance = atof(optarg);
         continue;
+      case 'g':
+        calibrate = true;
+        continue;
+      case 'P':
+        if (optarg) pitchSpan = static_cast<unsigned>(max(atoi(optarg), 1));
+        continue;
+      case 'j':
+        quickBass = true;
+        continue;
       case 'y':
         squareRoot = true;
         continue;
+      case 'v':
+        decibels = true;
+        continue;
       case 'd':
         decimal = true;
         continue;
+      case 'e':
+        binary = true;
+        continue;
+      case 'l':
+        if (optarg) listenAddress = optarg;
+        continue;
+      case 'q':
+        if (optarg) queueDepth = static_cast<unsigned>(atoi(optarg));
+        continue;
+      case 'S':
+        if (optarg) frameOutput = optarg;
+        continue;
+      case 'A':
+        adaptive = true;
+        continue;
+      case 'm':
+        realTime = true;
+        continue;
+      case 'u':
+        if (optarg) cpuCore = atoi(optarg);
+        realTime = true;
+        continue;
+      case 'f':
+        if (optarg) fifoPriority = atoi(optarg);
+        realTime = true;
+        continue;
+      case 'o':
+        if (optarg) archiveOutput = optarg;
+        continue;
+      case 'i':
+        if (optarg) archiveInput = optarg;
+        continue;
+      case 'w':
+        if (optarg) parseRange(optarg, timeFrom, timeTo);
+        continue;
+      case 'n':
+        if (optarg) parseRange(optarg, firstKey, lastKey);
+        continue;
+      case 'B':
+        if (optarg) batchInput = optarg;
+        continue;
+      case 'O':
+        if (optarg) batchOutput = optarg;
+        continue;
+      case 'T':
+        if (optarg) batchThreads = static_cast<unsigned>(max(atoi(optarg), 0));
+        continue;
+      case 'Z':
+        if (optarg) ringOutput = optarg;
+        continue;
+      case 'z':
+        if (optarg) ringInput = optarg;
+        continue;
+      case 'C':
+        if (optarg) captureOutput = optarg;
+        continue;
+      case 'R':
+        if (optarg) captureInput = optarg;
+        continue;
+      case 'F':
+        fastReplay = true;
+        continue;
       case 'h':
       default:
         help();
@@ -99,6 +535,68 @@ int main(int argc, char *argv[]) {
     break;
   }
 
+  if (squareRoot && decibels) {
+    cerr << "-y and -v are mutually exclusive" << endl;
+    return EXIT_FAILURE;
+  }
+
+  if (decimal && binary) {
+    cerr << "-d and -e are mutually exclusive" << endl;
+    return EXIT_FAILURE;
+  }
+
+  if (!archiveInput.empty()) {
+    try {
+      return decodeArchive(archiveInput, timeFrom, timeTo, firstKey, lastKey, decimal, binary);
+    } catch (exception const& e) {
+      cerr << e.what() << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!ringOutput.empty()) {
+    try {
+      return captureToRing(ringOutput, samples, channels, sampleRate);
+    } catch (exception const& e) {
+      cerr << e.what() << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  unique_ptr<SharedRingReader> ring;
+  if (!ringInput.empty()) {
+    try {
+      ring = make_unique<SharedRingReader>(ringInput);
+    } catch (exception const& e) {
+      cerr << e.what() << endl;
+      return EXIT_FAILURE;
+    }
+    channels = ring->channels();
+    sampleRate = static_cast<int>(ring->sampleRate());
+    if (samples > ring->capacity() / 2) {
+      cerr << "buffer size must be at most " << ring->capacity() / 2 << " samples with this ring" << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  unique_ptr<CaptureReader> replay;
+  if (!captureInput.empty()) {
+    if (ring != nullptr) {
+      cerr << "-R and -z are mutually exclusive: there is only one input" << endl;
+      return EXIT_FAILURE;
+    }
+    try {
+      replay = make_unique<CaptureReader>(captureInput);
+    } catch (exception const& e) {
+      cerr << e.what() << endl;
+      return EXIT_FAILURE;
+    }
+    // the very same blocks, so the very same output
+    samples = replay->blockFrames;
+    channels = replay->channels;
+    sampleRate = static_cast<int>(replay->sampleRate);
+  }
+
   if (sampleRate < 8000 || sampleRate > 200000) {
     cerr << "sampleRate must be between 8000 and 200000 Hz" << endl;
     return EXIT_FAILURE;
@@ -109,6 +607,34 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
+  if (fifoPriority < 0 || fifoPriority > 99) {
+    cerr << "SCHED_FIFO priority must be between 1 and 99" << endl;
+    return EXIT_FAILURE;
+  }
+
+  if (!batchInput.empty()) {
+    if (calibrate) {
+      cerr << "-g does not apply to -B: all the files share the tuning" << endl;
+      return EXIT_FAILURE;
+    }
+    try {
+      return analyzeBatch(batchInput, {
+        samples, channels, sampleRate, pitchFork, averageWindow, threshold, keys, refKey, tolerance,
+        quickBass, pitchSpan, squareRoot, decibels, decimal, binary, batchOutput, batchThreads
+      });
+    } catch (exception const& e) {
+      cerr << e.what() << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  // none of the real-time switches is fatal; without the privileges, just carry on as usual
+  RealTime rt;
+  if (cpuCore >= 0 && !rt.pinToCore(static_cast<unsigned>(cpuCore)))
+    cerr << "warning: " << rt.error << endl;
+  if (fifoPriority > 0 && !rt.setFifoPriority(fifoPriority))
+    cerr << "warning: " << rt.error << endl;
+
   auto tuning = make_shared<PianoTuning>(
     sampleRate,
     keys,
@@ -117,45 +643,250 @@ int main(int argc, char *argv[]) {
     tolerance
   );
   auto sdft = SlidingDFT(tuning, -1.);
+  auto calibrator = PitchCalibrator();
+  // at the low output rates, evaluating the bands once per block is cheaper than sliding them by every sample
+  unique_ptr<HopDFT> hopDFT;
+  if (averageWindow == 0. && !calibrate && !quickBass && pitchSpan == 0 && HopDFT::preferred(tuning, samples))
+    hopDFT = make_unique<HopDFT>(tuning);
+  unique_ptr<PitchTracker> tracker;
+  if (pitchSpan > 0)
+    tracker = make_unique<PitchTracker>(0, pitchSpan);
+  unique_ptr<OnsetBooster> booster;
+  if (quickBass)
+    booster = make_unique<OnsetBooster>(sdft);
+  auto transform = OutputTransform(
+    sdft.bands,
+    decibels
+      ? OutputTransform::DECIBELS
+      : squareRoot ? OutputTransform::SQUARE_ROOT : OutputTransform::LINEAR,
+    threshold
+  );
 
   try {
-    auto stdin_handle = freopen(nullptr, "rb", stdin);
-    if (ferror(stdin_handle))
-      throw runtime_error(strerror(errno));
+    unique_ptr<FanOutServer> server;
+    if (!listenAddress.empty()) {
+      signal(SIGPIPE, SIG_IGN);
+      server = make_unique<FanOutServer>(listenAddress, queueDepth);
+    }
+    unique_ptr<SharedFrameWriter> frame;
+    if (!frameOutput.empty())
+      frame = make_unique<SharedFrameWriter>(frameOutput, sdft.bands, static_cast<unsigned>(sampleRate), static_cast<unsigned>(samples));
+    unique_ptr<SpectrogramWriter> archive;
+    if (!archiveOutput.empty())
+      archive = make_unique<SpectrogramWriter>(archiveOutput, tuning, samples, transform.scale);
+
+    unique_ptr<CaptureWriter> capture;
+    if (!captureOutput.empty())
+      capture = make_unique<CaptureWriter>(captureOutput, static_cast<unsigned>(channels), static_cast<unsigned>(sampleRate), static_cast<unsigned>(samples));
+
+    FILE *stdin_handle = nullptr;
+    if (ring == nullptr && replay == nullptr) {
+      stdin_handle = freopen(nullptr, "rb", stdin);
+      if (ferror(stdin_handle))
+        throw runtime_error(strerror(errno));
+      // what stdio buffered ahead would not show up as readable on the descriptor
+      if (server != nullptr)
+        setvbuf(stdin_handle, nullptr, _IONBF, 0);
+    }
 
     size_t len;
     size_t bufferSize = samples * channels;
     vector<float> buffer(bufferSize);
     vector<float> input(samples);
     const float *output = nullptr;
+    vector<float> valuesFloat(sdft.bands);
+    vector<uint8_t> valuesInt(sdft.bands);
 
-    while ((len = fread(buffer.data(), sizeof(buffer[0]), bufferSize, stdin_handle)) > 0) {
-      if (ferror(stdin_handle) && !feof(stdin_handle))
+    auto monitor = DeadlineMonitor(samples, static_cast<unsigned>(sampleRate));
+    // the load shedding steps, from the least noticeable loss of quality on; step 0 is the full quality
+    vector<string> steps = { "full quality" };
+    unsigned optionalStep = UINT_MAX, blockRateStep = UINT_MAX, octaveStep = UINT_MAX;
+    if (calibrate || tracker != nullptr) {
+      optionalStep = steps.size();
+      steps.push_back("pitch tracking & calibration off");
+    }
+    if (hopDFT == nullptr && averageWindow > 0.) {
+      blockRateStep = steps.size();
+      steps.push_back("moving average off");
+    }
+    if (hopDFT == nullptr) {
+      octaveStep = steps.size();
+      for (int octave = 1; octave <= 2 && keys > 12 * octave; octave++)
+        steps.push_back(octave == 1 ? "top octave off" : "top " + to_string(octave) + " octaves off");
+    }
+    unique_ptr<OverloadController> controller;
+    if (adaptive)
+      controller = make_unique<OverloadController>(monitor.budget, steps.size() - 1);
+    const bool timed = realTime || adaptive;
+    unsigned shedStep = 0;
+    bool optionalOff = false;
+    double effectiveAverageWindow = averageWindow;
+    vector<float> noPitch(sdft.bands);
+    auto lastReport = chrono::steady_clock::time_point();
+    unsigned long reportedMisses = 0;
+    if (realTime) {
+      // silence on top of the (silent) initial state changes nothing, but allocates the lazily sized buffers
+      // of whichever analyzer the loop uses, & of the stages after it (which then forget that block)
+      if (hopDFT != nullptr) {
+        hopDFT->process(input.data(), samples);
+      } else {
+        sdft.process(input.data(), samples, averageWindow);
+        if (booster != nullptr) {
+          booster->update(sdft, static_cast<unsigned>(samples));
+          booster->reset();
+        }
+        if (calibrate) {
+          calibrator.update(sdft, static_cast<unsigned>(samples));
+          calibrator.reset();
+        }
+        if (tracker != nullptr) {
+          tracker->update(sdft, static_cast<unsigned>(samples));
+          tracker->reset();
+        }
+      }
+      transform.apply(input.data(), valuesFloat.data());
+      transform.apply(input.data(), valuesInt.data());
+      if (!rt.lockMemory())
+        cerr << "warning: " << rt.error << endl;
+      RealTime::prefaultStack();
+    }
+    // let the summary be printed, the shared frame be closed, the archive be indexed & the capture be flushed on the way out
+    if (realTime || frame != nullptr || archive != nullptr || capture != nullptr)
+      Interrupt::install();
+
+    // the next block of interleaved samples: read from stdin, from a capture, or in place from the shared ring
+    const float *block = buffer.data();
+    const auto start = chrono::steady_clock::now();
+    auto next = [&]() -> size_t {
+      if (replay != nullptr) {
+        const size_t values = replay->read(buffer.data());
+        if (values > 0 && !fastReplay)
+          this_thread::sleep_until(start + chrono::microseconds(replay->time));
+        return values;
+      }
+      if (ring == nullptr) {
+        // the clients keep getting accepted & drained while the input stalls
+        while (server != nullptr && !server->serveUntilReadable(fileno(stdin_handle)))
+          if (Interrupt::requested())
+            return 0;
+        return fread(buffer.data(), sizeof(buffer[0]), bufferSize, stdin_handle);
+      }
+      for (;;) {
+        size_t frames = samples;
+        if ((block = ring->acquire(frames)) != nullptr)
+          return frames * channels;
+        if (Interrupt::requested() || ring->ended())
+          return 0;
+      }
+    };
+
+    while (!Interrupt::requested() && (len = next()) > 0) {
+      if (stdin_handle != nullptr && ferror(stdin_handle) && !feof(stdin_handle) && !Interrupt::requested())
         throw runtime_error(strerror(errno));
+      const auto arrival = chrono::steady_clock::now();
+      if (timed)
+        monitor.start();
 
+      // the ring may reuse the block as soon as it is released
+      if (capture != nullptr && block != buffer.data()) {
+        memcpy(buffer.data(), block, len * sizeof(buffer[0]));
+        block = buffer.data();
+      }
       memset(input.data(), 0, sizeof(input[0]) * samples);
       for (unsigned i = 0; i < len; i++)
-        input[i / channels] += buffer[i];
+        input[i / channels] += block[i];
+      // the capture went over the block while it was being read; better skip it than analyze a glitch
+      if (ring != nullptr && !ring->release())
+        continue;
+      // only the blocks that get analyzed, so that the replay goes down the same path
+      if (capture != nullptr)
+        capture->write(block, len, static_cast<uint64_t>(chrono::duration_cast<chrono::microseconds>(arrival - start).count()));
 
-      if ((output = sdft.process(input.data(), samples, averageWindow)) == nullptr)
+      output = hopDFT != nullptr
+        ? hopDFT->process(input.data(), samples)
+        : sdft.process(input.data(), samples, effectiveAverageWindow);
+      if (output == nullptr)
         throw runtime_error("sdft.process() returned nothing");
+      if (booster != nullptr)
+        output = booster->update(sdft, static_cast<unsigned>(samples));
+      if (calibrate && !optionalOff) {
+        calibrator.update(sdft, static_cast<unsigned>(samples));
+        if (calibrator.calibrate(sdft))
+          cerr << "calibrated: A4=" << calibrator.pitchFork << "Hz" << endl;
+      }
+      // while shed, the pitch reads 0, so the frames keep their format
+      const float *cents = tracker == nullptr
+        ? nullptr
+        : optionalOff ? noPitch.data() : tracker->update(sdft, static_cast<unsigned>(samples));
+
+      // the display consumers take the levels as they are; the text is only made for somebody to read it
+      if (frame != nullptr) {
+        transform.apply(output, valuesFloat.data());
+        frame->publish(valuesFloat.data());
+      }
+      const bool serialize = frame == nullptr || server != nullptr;
 
       stringstream stream;
-      for (unsigned i = 0; i < sdft.bands; i++) {
-        const float step1 = squareRoot ? std::sqrt(output[i]) : output[i];
-        const float step2 = step1 > threshold ? step1 : 0.;
-        const float valueFloat = clamp(step2, 0., 1.);
-        if (decimal) {
-          stream << valueFloat;
-          if (i < sdft.bands - 1)
-            stream << ' ';
-        } else {
-          unsigned valueInt = static_cast<unsigned>(std::round(255. * valueFloat));
-          stream << setfill('0') << setw(2) << hex << valueInt;
+      if (serialize)
+        serializeFrame(stream, transform, output, cents, decimal, binary, valuesFloat, valuesInt);
+
+      if (archive != nullptr) {
+        if (decimal || !serialize)
+          transform.apply(output, valuesInt.data());
+        archive->write(valuesInt.data());
+      }
+
+      if (server != nullptr) {
+        server->broadcast(stream.str());
+        server->poll();
+      } else if (serialize) {
+        cout << stream.str() << flush;
+      }
+
+      if (!timed)
+        continue;
+      if (monitor.stop() && realTime && monitor.misses > reportedMisses) {
+        // at most one line per second, even when overloaded
+        const auto now = chrono::steady_clock::now();
+        if (now - lastReport >= chrono::seconds(1)) {
+          cerr << "deadline miss: " << monitor.report() << endl;
+          reportedMisses = monitor.misses;
+          lastReport = now;
         }
       }
-      cout << stream.str() << endl;
+
+      if (controller != nullptr && controller->update(monitor.last)) {
+        const unsigned step = controller->step;
+        if (optionalOff && step < optionalStep) {
+          // the phases moved on meanwhile
+          if (tracker != nullptr)
+            tracker->reset();
+          calibrator.reset();
+        }
+        optionalOff = step >= optionalStep;
+        effectiveAverageWindow = step >= blockRateStep ? 0. : averageWindow;
+        const unsigned octaves = step >= octaveStep ? step - octaveStep + 1 : 0;
+        sdft.bandLimit(octaves > 0 ? tuning->keyToFreq(keys - 12. * octaves - .5) : 0.);
+        cerr << (step > shedStep ? "overload" : "recovered") << ": step " << step << " of " << controller->steps
+          << " (" << steps[step] << "): " << controller->reason << endl;
+        shedStep = step;
+      }
+    }
+
+    if (realTime)
+      cerr << monitor.report() << endl;
+    if (controller != nullptr)
+      cerr << "load shedding: " << controller->changes << " step changes; now at step " << controller->step
+        << " (" << steps[controller->step] << ")" << endl;
+    if (ring != nullptr && (ring->dropped > 0 || ring->torn > 0))
+      cerr << "shared ring: " << ring->dropped << " frames skipped, " << ring->torn << " blocks overwritten while in use" << endl;
+    if (replay != nullptr) {
+      const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+      cerr << "replay: " << replay->blocks << " blocks, " << replay->time / 1e6 << "s recorded, replayed in "
+        << elapsed << "s" << endl;
     }
+    if (capture != nullptr)
+      capture->flush();
   } catch (exception const& e) {
     cerr << e.what() << endl;
   }
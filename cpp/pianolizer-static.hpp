@@ -0,0 +1,310 @@
+/**
+ * @file pianolizer-static.hpp
+ * @brief Compile-time variant of PianoTuning & SlidingDFT, for the builds where the sample rate, key layout & block size are fixed.
+ * The (k, N) table & all the coefficients are computed by the compiler and end up in read-only memory;
+ * the kernels have compile-time trip counts, so they can be fully unrolled & vectorized.
+ * @see http://github.com/creaktive/pianolizer
+ * @author Stanislaw Pusep
+ * @copyright MIT
+ */
+
+#pragma once
+
+#include "pianolizer.hpp"
+
+/**
+ * Just enough of <cmath>, usable in constant expressions (C++14 has no constexpr std::pow & co).
+ *
+ * @class ConstMath
+ */
+class ConstMath {
+  public:
+    static constexpr double floor(const double x) {
+      const double t = static_cast<double>(static_cast<long long>(x));
+      return t > x ? t - 1. : t;
+    }
+
+    static constexpr double fabs(const double x) {
+      return x < 0. ? -x : x;
+    }
+
+    static constexpr double exp(const double x) {
+      double sum = 1., term = 1.;
+      for (unsigned n = 1; n < 64 && term != 0.; n++) {
+        term *= x / n;
+        sum += term;
+      }
+      return sum;
+    }
+
+    static constexpr double exp2(const double x) {
+      const double n = floor(x);
+      double scale = 1.;
+      for (long long i = 0; i < static_cast<long long>(n); i++)
+        scale *= 2.;
+      for (long long i = 0; i > static_cast<long long>(n); i--)
+        scale /= 2.;
+      return scale * exp((x - n) * M_LN2);
+    }
+
+    static constexpr double sin(const double x) {
+      // reduce to [-pi, pi]
+      const double turns = floor(x / (2. * M_PI) + .5);
+      const double y = x - turns * 2. * M_PI;
+      double sum = y, term = y;
+      for (unsigned n = 1; n < 32 && term != 0.; n++) {
+        term *= -y * y / ((2. * n) * (2. * n + 1.));
+        sum += term;
+      }
+      return sum;
+    }
+
+    static constexpr double cos(const double x) {
+      return sin(x + M_PI / 2.);
+    }
+};
+
+/**
+ * The table computed by StaticPianoTuning.
+ *
+ * @class StaticPianoTable
+ */
+template <unsigned Keys>
+struct StaticPianoTable {
+  unsigned k[Keys];
+  unsigned N[Keys];
+  double coeffRe[Keys];
+  double coeffIm[Keys];
+  unsigned maxN;
+};
+
+/**
+ * PianoTuning, evaluated by the compiler. Since C++14 does not allow floating point template parameters,
+ * the pitch fork is given in centihertz and the tolerance in percent.
+ * The results are the same as the ones of the runtime PianoTuning with the same parameters.
+ *
+ * @class StaticPianoTuning
+ * @extends Tuning
+ * @par EXAMPLE
+ * // the configuration of misc/pianolizer.sh
+ * using Tuning = StaticPianoTuning<24000, 72>;
+ * // prints the N for the note C2:
+ * std::cout << Tuning::table.N[0] << std::endl;
+ */
+template <
+  unsigned SampleRate,
+  unsigned Keys = 61,
+  unsigned ReferenceKey = 33,
+  unsigned PitchForkCentiHz = 44000,
+  unsigned TolerancePercent = 100
+>
+class StaticPianoTuning : public Tuning {
+  private:
+    static constexpr double keyToFreq(const double key) {
+      return PitchForkCentiHz / 100. * ConstMath::exp2((key - ReferenceKey) / 12.);
+    }
+
+    // same as Tuning::frequencyAndBandwidthToKAndN()
+    static constexpr void frequencyAndBandwidthToKAndN(
+      const double frequency,
+      const double bandwidth,
+      unsigned& kOut,
+      unsigned& NOut
+    ) {
+      double N = ConstMath::floor(SampleRate / bandwidth);
+      const double k = ConstMath::floor(frequency / bandwidth);
+
+      double delta = ConstMath::fabs(SampleRate * (k / N) - frequency);
+      for (unsigned i = static_cast<unsigned>(N) - 1; i > 0; i--) {
+        const double tmpDelta = ConstMath::fabs(SampleRate * (k / i) - frequency);
+        if (tmpDelta < delta) {
+          delta = tmpDelta;
+          N = i;
+        } else {
+          break;
+        }
+      }
+
+      kOut = static_cast<unsigned>(k);
+      NOut = static_cast<unsigned>(N);
+    }
+
+    static constexpr StaticPianoTable<Keys> makeTable() {
+      StaticPianoTable<Keys> output{};
+      for (unsigned key = 0; key < Keys; key++) {
+        const double frequency = keyToFreq(key);
+        const double bandwidth = 2. * (keyToFreq(key + .5 * (TolerancePercent / 100.)) - frequency);
+        frequencyAndBandwidthToKAndN(frequency, bandwidth, output.k[key], output.N[key]);
+
+        const double q = 2. * M_PI * output.k[key] / output.N[key];
+        output.coeffRe[key] = ConstMath::cos(q);
+        output.coeffIm[key] = -ConstMath::sin(q);
+        if (output.N[key] > output.maxN)
+          output.maxN = output.N[key];
+      }
+      return output;
+    }
+
+  public:
+    static constexpr unsigned sampleRateValue = SampleRate;
+    static constexpr unsigned keys = Keys;
+    static constexpr StaticPianoTable<Keys> table = makeTable();
+
+    static_assert(SampleRate > 0 && Keys > 0, "sample rate & number of keys must be positive");
+    static_assert(TolerancePercent > 0 && TolerancePercent <= 100, "tolerance must be in the range (0, 100]");
+
+    StaticPianoTuning()
+      : Tuning{ SampleRate, Keys }
+    {}
+
+    /**
+     * Same as PianoTuning::mapping(), so that the runtime SlidingDFT can also be used with it.
+     *
+     * @memberof StaticPianoTuning
+     */
+    const std::vector<tuningValues> mapping() {
+      std::vector<tuningValues> output;
+      output.reserve(Keys);
+      for (unsigned key = 0; key < Keys; key++)
+        output.push_back({ table.k[key], table.N[key] });
+      return output;
+    }
+};
+
+// C++14 still needs the namespace-scope definitions of the static members that get ODR-used
+template <unsigned SampleRate, unsigned Keys, unsigned ReferenceKey, unsigned PitchForkCentiHz, unsigned TolerancePercent>
+constexpr unsigned StaticPianoTuning<SampleRate, Keys, ReferenceKey, PitchForkCentiHz, TolerancePercent>::sampleRateValue;
+template <unsigned SampleRate, unsigned Keys, unsigned ReferenceKey, unsigned PitchForkCentiHz, unsigned TolerancePercent>
+constexpr unsigned StaticPianoTuning<SampleRate, Keys, ReferenceKey, PitchForkCentiHz, TolerancePercent>::keys;
+template <unsigned SampleRate, unsigned Keys, unsigned ReferenceKey, unsigned PitchForkCentiHz, unsigned TolerancePercent>
+constexpr StaticPianoTable<Keys> StaticPianoTuning<SampleRate, Keys, ReferenceKey, PitchForkCentiHz, TolerancePercent>::table;
+
+/**
+ * Powers of the DFTBin coefficients for the block-rate kernel (see DFTBin::updateBlock()).
+ *
+ * @class StaticBlockTable
+ */
+template <unsigned Keys, unsigned BlockSize>
+struct StaticBlockTable {
+  double re[Keys][BlockSize];
+  double im[Keys][BlockSize];
+  double rotationRe[Keys];
+  double rotationIm[Keys];
+};
+
+/**
+ * Block-rate SlidingDFT with everything fixed at compile time: the tuning (a StaticPianoTuning),
+ * the block size & the history length. No moving average; the levels are computed once per block.
+ *
+ * @class StaticSlidingDFT
+ * @par EXAMPLE
+ * StaticSlidingDFT<StaticPianoTuning<24000, 72>, 240> slidingDFT;
+ * float input[240];
+ * // fill the input buffer with the samples
+ * const float *output = slidingDFT.process(input);
+ */
+template <class StaticTuning, unsigned BlockSize, unsigned HistoryLength = StaticTuning::table.maxN>
+class StaticSlidingDFT {
+  private:
+    static constexpr unsigned Keys = StaticTuning::keys;
+
+    static constexpr unsigned roundUpToPowerOfTwo(const unsigned n) {
+      unsigned size = 1;
+      while (size < n)
+        size <<= 1;
+      return size;
+    }
+
+    static constexpr unsigned historySize = roundUpToPowerOfTwo(HistoryLength);
+    static constexpr unsigned mask = historySize - 1;
+
+    using BlockTable = StaticBlockTable<StaticTuning::keys, BlockSize>;
+
+    static constexpr BlockTable makeBlockTable() {
+      BlockTable output{};
+      for (unsigned key = 0; key < Keys; key++) {
+        const double q = 2. * M_PI * StaticTuning::table.k[key] / StaticTuning::table.N[key];
+        for (unsigned j = 0; j < BlockSize; j++) {
+          output.re[key][j] = ConstMath::cos(q * (BlockSize - j));
+          output.im[key][j] = -ConstMath::sin(q * (BlockSize - j));
+        }
+        output.rotationRe[key] = ConstMath::cos(q * BlockSize);
+        output.rotationIm[key] = -ConstMath::sin(q * BlockSize);
+      }
+      return output;
+    }
+
+    static_assert(BlockSize > 0, "block size must be positive");
+    static_assert(HistoryLength >= StaticTuning::table.maxN, "history is shorter than the longest bin");
+
+    float history[historySize] = {};
+    unsigned index = 0;
+    double dftRe[Keys] = {}, dftIm[Keys] = {}, totalPower[Keys] = {};
+    float levels[Keys] = {};
+
+  public:
+    static constexpr unsigned sampleRate = StaticTuning::sampleRateValue;
+    static constexpr unsigned bands = Keys;
+    static constexpr BlockTable blockTable = makeBlockTable();
+
+    /**
+     * Process a block of samples.
+     *
+     * @param samples Exactly BlockSize samples.
+     * @return Snapshot of the *squared* levels after processing all the samples (same as SlidingDFT::process()).
+     * @memberof StaticSlidingDFT
+     */
+    const float* process(const float samples[BlockSize]) {
+      float previous[BlockSize];
+
+      for (unsigned key = 0; key < Keys; key++) {
+        // gather the samples that expire during this block (see SlidingDFT::processBlock())
+        const unsigned N = StaticTuning::table.N[key];
+        const unsigned fromHistory = std::min(N, BlockSize);
+        const unsigned start = (index - N) & mask;
+        const unsigned head = std::min(fromHistory, historySize - start);
+        memcpy(previous, history + start, sizeof(float) * head);
+        memcpy(previous + head, history, sizeof(float) * (fromHistory - head));
+        if (fromHistory < BlockSize)
+          memcpy(previous + fromHistory, samples, sizeof(float) * (BlockSize - fromHistory));
+
+        const double *powRe = blockTable.re[key];
+        const double *powIm = blockTable.im[key];
+        double re = 0., im = 0., power = 0.;
+        for (unsigned j = 0; j < BlockSize; j++) {
+          const double previousSample = previous[j];
+          const double currentSample = samples[j];
+          const double delta = currentSample - previousSample;
+          re += powRe[j] * delta;
+          im += powIm[j] * delta;
+          power += currentSample * currentSample - previousSample * previousSample;
+        }
+
+        const double rotationRe = blockTable.rotationRe[key];
+        const double rotationIm = blockTable.rotationIm[key];
+        const double stateRe = dftRe[key];
+        const double stateIm = dftIm[key];
+        dftRe[key] = rotationRe * stateRe - rotationIm * stateIm + re;
+        dftIm[key] = rotationRe * stateIm + rotationIm * stateRe + im;
+        totalPower[key] += power;
+
+        // same as DFTBin::normalizedAmplitudeSpectrum()
+        levels[key] = totalPower[key] > 0.
+          ? (2. / N) * (dftRe[key] * dftRe[key] + dftIm[key] * dftIm[key]) / totalPower[key]
+          : 0.;
+      }
+
+      for (unsigned j = 0; j < BlockSize; j++)
+        history[(index + j) & mask] = samples[j];
+      index = (index + BlockSize) & mask;
+
+      return levels;
+    }
+};
+
+template <class StaticTuning, unsigned BlockSize, unsigned HistoryLength>
+constexpr unsigned StaticSlidingDFT<StaticTuning, BlockSize, HistoryLength>::sampleRate;
+template <class StaticTuning, unsigned BlockSize, unsigned HistoryLength>
+constexpr unsigned StaticSlidingDFT<StaticTuning, BlockSize, HistoryLength>::bands;
+template <class StaticTuning, unsigned BlockSize, unsigned HistoryLength>
+constexpr typename StaticSlidingDFT<StaticTuning, BlockSize, HistoryLength>::BlockTable StaticSlidingDFT<StaticTuning, BlockSize, HistoryLength>::blockTable;
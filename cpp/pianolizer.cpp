@@ -7,6 +7,9 @@ class Pianolizer {
   private:
     std::shared_ptr<Tuning> tuning;
     std::unique_ptr<SlidingDFT> slidingDFT;
+    std::unique_ptr<OutputTransform> transform;
+    std::vector<float> output;
+    float threshold = 0.;
 
   public:
     Pianolizer(
@@ -24,12 +27,25 @@ class Pianolizer {
         tolerance
       );
       slidingDFT = std::make_unique<SlidingDFT>(tuning, -1.);
+      transform = std::make_unique<OutputTransform>(tuning->bands);
+      output.resize(tuning->bands);
     }
 
-    val process(const uintptr_t samplesPtr, const unsigned samplesLength, const double averageWindowInSeconds = 0.) {
+    val process(
+      const uintptr_t samplesPtr,
+      const unsigned samplesLength,
+      const double averageWindowInSeconds = 0.,
+      const float threshold_ = 0.
+    ) {
+      if (threshold_ != threshold) {
+        threshold = threshold_;
+        std::fill(transform->threshold.begin(), transform->threshold.end(), threshold);
+      }
+
       auto samples = reinterpret_cast<float*>(samplesPtr);
       auto levels = slidingDFT->process(samples, samplesLength, averageWindowInSeconds);
-      return val(typed_memory_view(tuning->bands, levels));
+      transform->apply(levels, output.data());
+      return val(typed_memory_view(tuning->bands, output.data()));
     }
 };
 
@@ -9,10 +9,15 @@
 #pragma once
 
 #define _USE_MATH_DEFINES
+#include <algorithm>
 #include <cmath>
 #include <complex>
+#include <cstdint>
 #include <cstring>
+#include <map>
 #include <memory>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 // For C++11 compatibility: https://herbsutter.com/gotw/_102/
@@ -44,6 +49,8 @@ class RingBuffer {
     std::vector<float> buffer;
 
   public:
+    // read() returns exactly what was written
+    static constexpr bool lossless = true;
     unsigned size;
 
     /**
@@ -70,6 +77,26 @@ class RingBuffer {
       buffer[index++] = value;
     }
 
+    /**
+     * Fills the RingBuffer with zeros, as if it was just created.
+     *
+     * @memberof RingBuffer
+     */
+    void reset() {
+      memset(buffer.data(), 0, sizeof(float) * size);
+      index = 0;
+    }
+
+    /**
+     * What read() will return for the value, once written (the value itself).
+     *
+     * @param value Value to be stored.
+     * @memberof RingBuffer
+     */
+    float quantize(const float value) const {
+      return value;
+    }
+
     /**
      * Retrieves the value stored at the position.
      *
@@ -80,6 +107,134 @@ class RingBuffer {
     float read(const unsigned position) {
       return buffer[(index + (~position)) & mask];
     }
+
+    /**
+     * Copies a contiguous stretch of the RingBuffer, oldest value first.
+     * Equivalent to output[j] = read(position - j), for j from 0 to length - 1.
+     *
+     * @param position Position of the oldest value to copy.
+     * @param length How many values to copy (must not exceed position + 1).
+     * @param output Destination array.
+     * @memberof RingBuffer
+     */
+    void readChunk(const unsigned position, const unsigned length, float output[]) {
+      const unsigned start = (index + (~position)) & mask;
+      const unsigned head = std::min(length, size - start);
+      memcpy(output, buffer.data() + start, sizeof(float) * head);
+      memcpy(output + head, buffer.data(), sizeof(float) * (length - head));
+    }
+};
+
+/**
+ * Drop-in replacement for RingBuffer that takes ~4x less memory: the samples are stored as 16-bit integers
+ * (scaled so that fullScale maps to 32767 & clipped beyond that), and the size is exactly the requested one
+ * instead of the next power of two. The samples are decoded back to float when read, so the users
+ * (for instance, BasicSlidingDFT<CompactRingBuffer>) do not change; the quantization error is about
+ * fullScale / 65536, which is some 96 dB under the full scale.
+ *
+ * @class CompactRingBuffer
+ * @par EXAMPLE
+ * auto rb = CompactRingBuffer(100);
+ * for (unsigned i = 0; i < 200; i++)
+ *   rb.write(i / 200.);
+ * // prints 0.995
+ * std::cout << rb.read(0) << std::endl;
+ */
+class CompactRingBuffer {
+  private:
+    unsigned index = 0;
+    std::vector<int16_t> buffer;
+    float encodeScale, decodeScale;
+
+    int16_t encode(const float value) const {
+      const float scaled = std::max(-32767.f, std::min(32767.f, value * encodeScale));
+      return static_cast<int16_t>(std::lrint(scaled));
+    }
+
+    // slot of read(position)
+    unsigned slot(unsigned position) const {
+      if (position >= size)
+        position %= size;
+      return index > position ? index - 1 - position : index + size - 1 - position;
+    }
+
+  public:
+    static constexpr bool lossless = false;
+    unsigned size;
+
+    /**
+     * Creates an instance of CompactRingBuffer.
+     * @param requestedSize How long the CompactRingBuffer is.
+     * @param [fullScale=1.0] Largest magnitude of the samples that can be stored.
+     * @memberof CompactRingBuffer
+     */
+    CompactRingBuffer(const unsigned requestedSize, const float fullScale = 1.)
+      : buffer(requestedSize, 0), encodeScale(32767.f / fullScale), decodeScale(fullScale / 32767.f), size(requestedSize) {
+      if (requestedSize == 0)
+        throw std::invalid_argument("CompactRingBuffer can not be empty");
+    }
+
+    /**
+     * Shifts the CompactRingBuffer and stores the value in the latest position.
+     *
+     * @param value Value to be stored.
+     * @memberof CompactRingBuffer
+     */
+    void write(const float value) {
+      buffer[index] = encode(value);
+      if (++index == size)
+        index = 0;
+    }
+
+    /**
+     * Fills the CompactRingBuffer with zeros, as if it was just created.
+     *
+     * @memberof CompactRingBuffer
+     */
+    void reset() {
+      std::fill(buffer.begin(), buffer.end(), 0);
+      index = 0;
+    }
+
+    /**
+     * What read() will return for the value, once written.
+     *
+     * @param value Value to be stored.
+     * @memberof CompactRingBuffer
+     */
+    float quantize(const float value) const {
+      return encode(value) * decodeScale;
+    }
+
+    /**
+     * Retrieves the value stored at the position.
+     *
+     * @param position Position within the CompactRingBuffer.
+     * @return The value at the position.
+     * @memberof CompactRingBuffer
+     */
+    float read(const unsigned position) const {
+      return buffer[slot(position)] * decodeScale;
+    }
+
+    /**
+     * Same as RingBuffer::readChunk(); decodes while copying (which vectorizes).
+     *
+     * @param position Position of the oldest value to copy.
+     * @param length How many values to copy (must not exceed position + 1).
+     * @param output Destination array.
+     * @memberof CompactRingBuffer
+     */
+    void readChunk(const unsigned position, const unsigned length, float output[]) const {
+      const unsigned start = slot(position);
+      const unsigned head = std::min(length, size - start);
+      const int16_t *chunk = buffer.data() + start;
+      for (unsigned j = 0; j < head; j++)
+        output[j] = chunk[j] * decodeScale;
+      const unsigned tail = length - head;
+      for (unsigned j = 0; j < tail; j++)
+        output[head + j] = buffer[j] * decodeScale;
+    }
 };
 
 /**
@@ -110,6 +265,9 @@ class DFTBin {
     double r;
     std::complex<double> coeff;
     std::complex<double> dft = std::complex<double>(0., 0.);
+    // powers of coeff for updateBlock(), in the order they are applied to the block samples
+    std::complex<double> blockCoeff = std::complex<double>(1., 0.);
+    std::vector<double> blockCoeffRe, blockCoeffIm;
 
   public:
     double k, N;
@@ -140,6 +298,16 @@ class DFTBin {
       coeff = std::complex<double>(cos(q), -sin(q));
     }
 
+    /**
+     * Back to silence, as if the bin was just created.
+     *
+     * @memberof DFTBin
+     */
+    void reset() {
+      totalPower = 0.;
+      dft = std::complex<double>(0., 0.);
+    }
+
     /**
      * Do the Sliding DFT computation.
      *
@@ -154,6 +322,55 @@ class DFTBin {
       dft = coeff * (dft - std::complex<double>(previousSample, 0.) + std::complex<double>(currentSample, 0.));
     }
 
+    /**
+     * Do the Sliding DFT computation for a whole block of samples at once.
+     * Same result as calling update() for each pair of samples, but since the SDFT is linear,
+     * the B steps collapse into one rotation of the state plus a dot product of the sample
+     * differences with the precomputed powers of the coefficient (which vectorizes nicely).
+     *
+     * @param previousSamples Samples from N frames before each of currentSamples.
+     * @param currentSamples The latest samples, oldest first.
+     * @param length Block size; changing it between the calls recomputes the powers.
+     * @memberof DFTBin
+     */
+    void updateBlock(const float previousSamples[], const float currentSamples[], const unsigned length) {
+      if (blockCoeffRe.size() != length) {
+        const double q = 2. * M_PI * k / N;
+        blockCoeffRe.resize(length);
+        blockCoeffIm.resize(length);
+        for (unsigned j = 0; j < length; j++) {
+          const double phase = q * (length - j);
+          blockCoeffRe[j] = cos(phase);
+          blockCoeffIm[j] = -sin(phase);
+        }
+        blockCoeff = std::complex<double>(cos(q * length), -sin(q * length));
+      }
+
+      const double *powRe = blockCoeffRe.data();
+      const double *powIm = blockCoeffIm.data();
+      double re = 0., im = 0., power = 0.;
+      for (unsigned j = 0; j < length; j++) {
+        const double previousSample = previousSamples[j];
+        const double currentSample = currentSamples[j];
+        const double delta = currentSample - previousSample;
+        re += powRe[j] * delta;
+        im += powIm[j] * delta;
+        power += currentSample * currentSample - previousSample * previousSample;
+      }
+
+      totalPower += power;
+      dft = blockCoeff * dft + std::complex<double>(re, im);
+    }
+
+    /**
+     * The complex DFT value itself; for a steady tone, its phase advances by the angular frequency of the tone, per sample.
+     *
+     * @memberof DFTBin
+     */
+    std::complex<double> value() const {
+      return dft;
+    }
+
     /**
      * Root Mean Square.
      *
@@ -267,6 +484,16 @@ class MovingAverage {
       return sum[n] / averageWindow;
     }
 
+    /**
+     * Forget the averaged values; the next averageWindowInSeconds() call sets the window right away.
+     *
+     * @memberof MovingAverage
+     */
+    virtual void reset() {
+      memset(sum.data(), 0, sizeof(float) * channels);
+      averageWindow = -1;
+    }
+
     virtual void update(const std::vector<float>& levels) = 0;
 };
 
@@ -357,6 +584,12 @@ class HeavyMovingAverage : public MovingAverage {
         history.push_back(std::make_unique<RingBuffer>(maxWindow ? maxWindow : sampleRate));
     }
 
+    void reset() {
+      MovingAverage::reset();
+      for (auto& channel : history)
+        channel->reset();
+    }
+
     /**
      * Update the internal state with from the input.
      *
@@ -454,9 +687,9 @@ class Tuning {
  */
 class PianoTuning : public Tuning {
   private:
-    unsigned referenceKey;
-    double pitchFork;
-    double tolerance;
+    unsigned refKey;
+    double refFrequency;
+    double bandTolerance;
 
   public:
     /**
@@ -474,9 +707,36 @@ class PianoTuning : public Tuning {
       const unsigned referenceKey_ = 33,
       const double pitchFork_ = 440.0,
       const double tolerance_ = 1.
-    ) : Tuning{ sampleRate_, keysNum }, referenceKey(referenceKey_), pitchFork(pitchFork_), tolerance(tolerance_)
+    ) : Tuning{ sampleRate_, keysNum }, refKey(referenceKey_), refFrequency(pitchFork_), bandTolerance(tolerance_)
     {}
 
+    /**
+     * Key index of the pitchFork reference.
+     *
+     * @memberof PianoTuning
+     */
+    unsigned referenceKey() const {
+      return refKey;
+    }
+
+    /**
+     * Frequency of the reference key, in Hz.
+     *
+     * @memberof PianoTuning
+     */
+    double pitchFork() const {
+      return refFrequency;
+    }
+
+    /**
+     * Frequency tolerance, range (0.0, 1.0].
+     *
+     * @memberof PianoTuning
+     */
+    double tolerance() const {
+      return bandTolerance;
+    }
+
     /**
      * Converts the piano key number to it's fundamental frequency.
      *
@@ -486,7 +746,7 @@ class PianoTuning : public Tuning {
      * @memberof PianoTuning
      */
     double keyToFreq(const double key) {
-      return pitchFork * std::pow(2., (key - referenceKey) / 12.);
+      return refFrequency * std::pow(2., (key - refKey) / 12.);
     }
 
     /**
@@ -499,16 +759,112 @@ class PianoTuning : public Tuning {
       output.reserve(bands);
       for (unsigned key = 0; key < bands; key++) {
         const double frequency = keyToFreq(key);
-        const double bandwidth = 2. * (keyToFreq(key + .5 * tolerance) - frequency);
+        const double bandwidth = 2. * (keyToFreq(key + .5 * bandTolerance) - frequency);
         output.push_back(frequencyAndBandwidthToKAndN(frequency, bandwidth));
       }
       return output;
     }
 };
 
+/**
+ * Goertzel algorithm for many bands over the tails of one window of samples (the band with the window N
+ * sees the last N samples). The bands are interleaved, so that the loop vectorizes instead of waiting
+ * on one long dependency chain; hence, the bands should come longest first, so that the interleaved ones
+ * have similar N. The frequencies need not be integer multiples of the bandwidth.
+ *
+ * @class GoertzelBank
+ * @par EXAMPLE
+ * GoertzelBank goertzel;
+ * // window: the last 2000 samples, oldest first
+ * const std::vector<unsigned> order = { 0, 1 }, N = { 2000, 1000 };
+ * const std::vector<double> coeff = { GoertzelBank::coefficient(440., 44100), GoertzelBank::coefficient(880., 44100) };
+ * float levels[2];
+ * goertzel.evaluate(window, 2000, order, N, coeff, levels);
+ */
+class GoertzelBank {
+  private:
+    static constexpr unsigned lanes = 8;
+
+    std::vector<double> energy;
+
+  public:
+    /**
+     * The Goertzel coefficient of a frequency.
+     *
+     * @param frequency Frequency, in Hz.
+     * @param sampleRate Sample rate, in Hz.
+     * @memberof GoertzelBank
+     */
+    static double coefficient(const double frequency, const unsigned sampleRate) {
+      return 2. * cos(2. * M_PI * frequency / sampleRate);
+    }
+
+    /**
+     * Evaluates the bands.
+     *
+     * @param window Samples, oldest first.
+     * @param windowLength Number of samples in the window; at least the longest N.
+     * @param order Band indexes to evaluate, longest N first.
+     * @param N Window length of each band.
+     * @param coeff Goertzel coefficient of each band.
+     * @param levels Output, indexed by band: the same as DFTBin::normalizedAmplitudeSpectrum() over the last N samples.
+     * @memberof GoertzelBank
+     */
+    void evaluate(
+      const float window[],
+      const unsigned windowLength,
+      const std::vector<unsigned>& order,
+      const std::vector<unsigned>& N,
+      const std::vector<double>& coeff,
+      float levels[]
+    ) {
+      // the signal power over any tail of the window
+      energy.resize(windowLength + 1);
+      energy[0] = 0.;
+      for (unsigned j = 0; j < windowLength; j++)
+        energy[j + 1] = energy[j] + static_cast<double>(window[j]) * window[j];
+
+      const unsigned count = order.size();
+      for (unsigned group = 0; group < count; group += lanes) {
+        const unsigned used = std::min(count - group, static_cast<unsigned>(lanes));
+        const unsigned groupN = N[order[group]];
+        const float *x = window + (windowLength - groupN);
+
+        double c[lanes], s1[lanes], s2[lanes];
+        unsigned skip[lanes];
+        for (unsigned lane = 0; lane < lanes; lane++) {
+          const unsigned band = order[group + std::min(lane, used - 1)];
+          c[lane] = coeff[band];
+          // the shorter windows start later; feeding them zeros until then keeps their state at zero
+          skip[lane] = groupN - N[band];
+          s1[lane] = s2[lane] = 0.;
+        }
+
+        for (unsigned j = 0; j < groupN; j++) {
+          const double sample = x[j];
+          for (unsigned lane = 0; lane < lanes; lane++) {
+            const double s0 = (j >= skip[lane] ? sample : 0.) + c[lane] * s1[lane] - s2[lane];
+            s2[lane] = s1[lane];
+            s1[lane] = s0;
+          }
+        }
+
+        for (unsigned lane = 0; lane < used; lane++) {
+          const unsigned band = order[group + lane];
+          const double power = energy[windowLength] - energy[windowLength - N[band]];
+          const double dft = s1[lane] * s1[lane] + s2[lane] * s2[lane] - c[lane] * s1[lane] * s2[lane];
+          // same as DFTBin::normalizedAmplitudeSpectrum()
+          levels[band] = power > 0. ? (2. / N[band]) * dft / power : 0.;
+        }
+      }
+    }
+};
+
 /**
  * Sliding Discrete Fourier Transform implementation for (westerns) musical frequencies.
  *
+ * The sample history is a RingBuffer (float) or a CompactRingBuffer (int16; define COMPACT_HISTORY to make it the default).
+ *
  * @see https://www.comm.utoronto.ca/~dimitris/ece431/slidingdft.pdf
  * @class SlidingDFT
  * @par EXAMPLE
@@ -522,99 +878,1426 @@ class PianoTuning : public Tuning {
  * // just process; no moving average
  * output = slidingDFT.process(input);
  */
-class SlidingDFT {
+template <class History>
+class BasicSlidingDFT {
   private:
-    std::vector<std::shared_ptr<DFTBin>> bins;
-    std::vector<float> levels;
-    std::unique_ptr<RingBuffer> ringBuffer;
+    /**
+     * One Tuning over the shared history: picks its bands out of the (de-duplicated) bins,
+     * and has its own moving average & levels output.
+     */
+    struct View {
+      std::shared_ptr<Tuning> tuning;
+      std::vector<unsigned> binIndex;
+      bool identity; // binIndex[band] == band; the bin levels can be used directly
+      std::vector<float> levels;
+      double averageWindowInSeconds = 0.;
 #ifndef DISABLE_MOVING_AVERAGE
-    std::shared_ptr<MovingAverage> movingAverage;
+      std::shared_ptr<MovingAverage> movingAverage;
 #endif
+    };
 
-  public:
-    unsigned sampleRate, bands;
+    std::vector<std::shared_ptr<DFTBin>> bins;
+    std::vector<float> binLevels;
+    std::vector<uint8_t> binSuspended; // see bandLimit()
+    double bandLimitFrequency = 0.;
+    std::map<std::pair<unsigned, unsigned>, unsigned> binLookup;
+    std::vector<View> views;
 
     /**
-     * Creates an instance of SlidingDFT.
-     * @param tuning Tuning instance (a class derived from Tuning; for instance, PianoTuning).
-     * @param [maxAverageWindowInSeconds=0] Positive values are passed to MovingAverage implementation; negative values trigger FastMovingAverage implementation. Zero disables averaging.
+     * A retuneGradually() in progress: the bands move to their new bins one by one, each as soon as its bin
+     * is primed; priming one bin may take several process() calls, so its samples are kept aside.
+     */
+    struct PendingRetune {
+      unsigned view;
+      std::shared_ptr<Tuning> tuning;
+      std::vector<Tuning::tuningValues> mapping;
+      unsigned band = 0;            // the next band to move over
+      std::shared_ptr<DFTBin> bin;  // its new bin, while being primed
+      std::vector<float> window;    // what the bin is primed from: the last N samples, then the ones that came since
+      size_t fed = 0;               // how much of the window went into the bin so far
+      std::vector<float> previous;  // the samples leaving the bin, for DFTBin::updateBlock()
+    };
+    std::unique_ptr<PendingRetune> pending;
+
+    std::unique_ptr<History> ringBuffer;
+    std::vector<float> previousSamples, currentSamples;
+    GoertzelBank goertzel;
+    std::vector<float> queryWindow;
+
+    /**
+     * Returns the index of the bin with the given k & N, creating it when necessary.
+     * New bins are primed from the history, so they do not have to warm up from silence.
+     *
      * @memberof SlidingDFT
      */
-    SlidingDFT(const std::shared_ptr<Tuning> tuning, const double maxAverageWindowInSeconds = 0.) {
-      sampleRate = tuning->sampleRate;
-      bands = tuning->bands;
-      bins.reserve(bands);
-      levels.reserve(bands);
+    unsigned findOrCreateBin(const unsigned k, const unsigned N) {
+      const auto key = std::make_pair(k, N);
+      auto it = binLookup.find(key);
+      if (it != binLookup.end())
+        return it->second;
 
-      unsigned maxN = 0;
-      for (auto band : tuning->mapping()) {
-        bins.push_back(std::make_shared<DFTBin>(band.k, band.N));
-        maxN = std::max(maxN, band.N);
-      }
+      auto bin = std::make_shared<DFTBin>(k, N);
+      prime(*bin);
+      return insertBin(bin);
+    }
 
-      ringBuffer = std::make_unique<RingBuffer>(maxN);
+    /**
+     * Adds a bin that is already up to date.
+     *
+     * @memberof SlidingDFT
+     */
+    unsigned insertBin(const std::shared_ptr<DFTBin>& bin) {
+      const unsigned index = bins.size();
+      const bool suspended = isAboveBandLimit(*bin);
+      bins.push_back(bin);
+      binLevels.push_back(suspended ? 0.f : bin->normalizedAmplitudeSpectrum());
+      binSuspended.push_back(suspended);
+      binLookup[std::make_pair(static_cast<unsigned>(bin->k), static_cast<unsigned>(bin->N))] = index;
+      return index;
+    }
 
-#ifndef DISABLE_MOVING_AVERAGE
-      if (maxAverageWindowInSeconds > 0.) {
-        movingAverage = std::make_shared<HeavyMovingAverage>(
-          bands,
-          sampleRate,
-          std::round(sampleRate * maxAverageWindowInSeconds)
-        );
-      } else if (maxAverageWindowInSeconds < 0.) {
-        movingAverage = std::make_shared<FastMovingAverage>(
-          bands,
-          sampleRate
-        );
-      } else {
-        movingAverage = nullptr;
+    /**
+     * Moves the bands of the pending retune over, priming their new bins with at most budget sample updates
+     * (the bins that already exist cost nothing).
+     *
+     * @param samplesLength Number of samples just written to the history.
+     * @param budget Sample updates allowed.
+     * @memberof SlidingDFT
+     */
+    void advanceRetune(const unsigned samplesLength, size_t budget) {
+      PendingRetune& retune = *pending;
+      if (retune.bin != nullptr && samplesLength > 0) {
+        if (samplesLength < ringBuffer->size) {
+          const size_t end = retune.window.size();
+          retune.window.resize(end + samplesLength);
+          ringBuffer->readChunk(samplesLength - 1, samplesLength, retune.window.data() + end);
+        } else {
+          retune.bin = nullptr; // the block went past the history; start the bin over
+        }
       }
-#endif
+
+      View& target = views[retune.view];
+      const unsigned firstBand = retune.band;
+      const size_t fullBudget = budget;
+      while (retune.band < retune.mapping.size()) {
+        const auto& band = retune.mapping[retune.band];
+        auto it = binLookup.find(std::make_pair(band.k, band.N));
+        unsigned index;
+        if (it != binLookup.end()) {
+          index = it->second;
+        } else {
+          if (retune.bin == nullptr) {
+            // the powers of the coefficient for the block-rate kernel cost about as much as a few blocks of updates;
+            // leave that for the next call, unless this one has done nothing yet
+            const size_t setup = 4 * static_cast<size_t>(samplesLength);
+            if (budget < setup && budget < fullBudget)
+              break;
+            budget -= std::min(budget, setup);
+            retune.bin = std::make_shared<DFTBin>(band.k, band.N);
+            const unsigned available = std::min(band.N, ringBuffer->size);
+            retune.window.resize(available);
+            ringBuffer->readChunk(available - 1, available, retune.window.data());
+            retune.fed = 0;
+          }
+          // same as prime(), then the regular updates for the samples that came meanwhile;
+          // in whole blocks through the block-rate kernel (which is then ready for the live updates), the rest one by one
+          DFTBin& bin = *retune.bin;
+          const float *window = retune.window.data();
+          const size_t N = band.N;
+          const size_t end = std::min(retune.window.size(), retune.fed + budget);
+          budget -= end - retune.fed;
+          retune.previous.resize(samplesLength);
+          for (; samplesLength > 0 && retune.fed + samplesLength <= end; retune.fed += samplesLength) {
+            for (unsigned j = 0; j < samplesLength; j++) {
+              const size_t i = retune.fed + j;
+              retune.previous[j] = i >= N ? window[i - N] : 0.f;
+            }
+            bin.updateBlock(retune.previous.data(), window + retune.fed, samplesLength);
+          }
+          for (; retune.fed < end; retune.fed++)
+            bin.update(retune.fed >= N ? window[retune.fed - N] : 0., window[retune.fed]);
+          if (retune.fed < retune.window.size())
+            break;
+          index = insertBin(retune.bin);
+        }
+        retune.bin = nullptr;
+        target.binIndex[retune.band++] = index;
+      }
+
+      if (retune.band > firstBand)
+        pruneBins();
+      if (retune.band < retune.mapping.size())
+        return;
+      target.tuning = retune.tuning;
+      pending = nullptr;
     }
 
     /**
-     * Process a batch of samples.
+     * Brings a bin (fresh or left behind) up to date, from the history.
      *
-     * @param samples Array with the batch of samples to process. Value range is irrelevant (can be from -1.0 to 1.0 or 0 to 255 or whatever, as long as it is consistent).
-     * @param [averageWindowInSeconds=0] Adjust the moving average window size.
-     * @return Snapshot of the *squared* levels after processing all the samples. Value range is between 0.0 and 1.0. Depending on the application, you might need sqrt() of the level values (for visualization purposes it is actually better as is).
      * @memberof SlidingDFT
      */
-    const float* process(const float samples[], const size_t samplesLength, const double averageWindowInSeconds = 0.) {
-#ifndef DISABLE_MOVING_AVERAGE
-      if (movingAverage != nullptr)
-        movingAverage->averageWindowInSeconds(averageWindowInSeconds);
-#endif
+    void prime(DFTBin& bin) {
+      if (ringBuffer == nullptr)
+        return;
+      // replay the last N samples; whatever came before them is out of the window anyway
+      const unsigned N = bin.N;
+      const unsigned available = std::min(N, ringBuffer->size);
+      for (unsigned position = available; position > 0; position--)
+        bin.update(0., ringBuffer->read(position - 1));
+    }
 
-      const unsigned binsNum = bins.size();
+    bool isAboveBandLimit(const DFTBin& bin) const {
+      return bandLimitFrequency > 0. && bin.k * sampleRate / bin.N > bandLimitFrequency;
+    }
 
-      // store in the ring buffer & process
-      for (unsigned i = 0; i < samplesLength; i++) {
-        const float currentSample = samples[i];
-        ringBuffer->write(currentSample);
+    /**
+     * Grows the history (keeping its contents) so that it fits the longest bin.
+     *
+     * @memberof SlidingDFT
+     */
+    void fitRingBuffer(const unsigned N) {
+      // one extra slot: process() writes the current sample before reading the one from N samples ago
+      if (ringBuffer != nullptr && ringBuffer->size > N)
+        return;
+      auto grown = std::make_unique<History>(N + 1);
+      if (ringBuffer != nullptr)
+        for (unsigned position = ringBuffer->size; position > 0; position--)
+          grown->write(ringBuffer->read(position - 1));
+      ringBuffer = std::move(grown);
+    }
 
-        unsigned band = 0;
-        for (auto bin : bins) {
-          const float previousSample = ringBuffer->read(bin->N);
-          bin->update(previousSample, currentSample);
-          levels[band] = bin->normalizedAmplitudeSpectrum();
-          // levels[band] = bin->logarithmicUnitDecibels();
-          band++;
+    /**
+     * Drops the bins no view refers to anymore (for instance, after retune()).
+     *
+     * @memberof SlidingDFT
+     */
+    void pruneBins() {
+      const unsigned unassigned = ~0u;
+      std::vector<unsigned> remap(bins.size(), unassigned);
+      std::vector<std::shared_ptr<DFTBin>> keptBins;
+      std::vector<float> keptLevels;
+      std::vector<uint8_t> keptSuspended;
+
+      for (auto& view : views) {
+        for (auto& index : view.binIndex) {
+          if (remap[index] == unassigned) {
+            remap[index] = keptBins.size();
+            keptBins.push_back(bins[index]);
+            keptLevels.push_back(binLevels[index]);
+            keptSuspended.push_back(binSuspended[index]);
+          }
+          index = remap[index];
         }
+        updateIdentity(view);
+      }
+
+      bins = keptBins;
+      binLevels = keptLevels;
+      binSuspended = keptSuspended;
+      binLookup.clear();
+      for (unsigned index = 0; index < bins.size(); index++)
+        binLookup[std::make_pair(static_cast<unsigned>(bins[index]->k), static_cast<unsigned>(bins[index]->N))] = index;
+    }
 
-#ifdef DISABLE_MOVING_AVERAGE
+    /**
+     * Validates the new tuning of the view & makes room for it in the history.
+     *
+     * @memberof SlidingDFT
+     */
+    std::vector<Tuning::tuningValues> retuneMapping(const View& target, const std::shared_ptr<Tuning>& tuning) {
+      if (tuning->sampleRate != sampleRate)
+        throw std::invalid_argument("all the tunings must have the same sample rate");
+      if (tuning->bands != target.binIndex.size())
+        throw std::invalid_argument("retune() can not change the number of bands");
+
+      const auto mapping = tuning->mapping();
+      unsigned maxN = 0;
+      for (auto band : mapping)
+        maxN = std::max(maxN, band.N);
+      fitRingBuffer(maxN);
+      return mapping;
+    }
+
+    size_t retuneBudget(const unsigned samplesLength) const {
+      // more than the samples that keep coming in, or the bin being primed would never catch up
+      const size_t share = static_cast<size_t>(retuneLoad * bins.size() * samplesLength);
+      return std::max(share, 2 * static_cast<size_t>(samplesLength));
+    }
+
+    static void updateIdentity(View& view) {
+      view.identity = true;
+      for (unsigned band = 0; band < view.binIndex.size(); band++)
+        view.identity = view.identity && view.binIndex[band] == band;
+    }
+
+    /**
+     * Block-rate variant of process(): advances every bin by the whole block in one step,
+     * and computes the levels only once, after the last sample.
+     *
+     * @param samples Array with the batch of samples to process.
+     * @param samplesLength Number of samples in the batch.
+     * @memberof SlidingDFT
+     */
+    void processBlock(const float samples[], const unsigned samplesLength) {
+      if (!History::lossless) {
+        // the samples have to leave the bins with the same values they entered them, or the difference builds up
+        currentSamples.resize(samplesLength);
+        for (unsigned i = 0; i < samplesLength; i++)
+          currentSamples[i] = ringBuffer->quantize(samples[i]);
+        samples = currentSamples.data();
       }
-#else
-        if (movingAverage != nullptr)
-          movingAverage->update(levels);
+
+      previousSamples.resize(samplesLength);
+      float *previous = previousSamples.data();
+
+      for (unsigned index = 0; index < bins.size(); index++) {
+        if (binSuspended[index])
+          continue;
+        DFTBin *bin = bins[index].get();
+        // gather the samples that expire during this block;
+        // when the block is longer than N, the newest of them come from the block itself
+        const unsigned N = bin->N;
+        const unsigned fromHistory = std::min(N, samplesLength);
+        ringBuffer->readChunk(N - 1, fromHistory, previous);
+        if (fromHistory < samplesLength)
+          memcpy(previous + fromHistory, samples, sizeof(float) * (samplesLength - fromHistory));
+
+        bin->updateBlock(previous, samples, samplesLength);
+        binLevels[index] = bin->normalizedAmplitudeSpectrum();
       }
 
-      // snapshot of the levels, after smoothing
-      if (movingAverage != nullptr && movingAverage->averageWindow > 0)
-        for (unsigned band = 0; band < binsNum; band++)
-          levels[band] = movingAverage->read(band);
-#endif
+      for (unsigned i = 0; i < samplesLength; i++)
+        ringBuffer->write(samples[i]);
+    }
 
-      return levels.data();
+    /**
+     * Copies the bin levels into the levels of the view.
+     *
+     * @memberof SlidingDFT
+     */
+    void gatherLevels(View& view) {
+      const unsigned viewBands = view.binIndex.size();
+      for (unsigned band = 0; band < viewBands; band++)
+        view.levels[band] = binLevels[view.binIndex[band]];
+    }
+
+#ifndef DISABLE_MOVING_AVERAGE
+    /**
+     * Feeds the current bin levels to the moving average of each view.
+     *
+     * @memberof SlidingDFT
+     */
+    void updateMovingAverages() {
+      for (auto& view : views) {
+        if (view.movingAverage == nullptr)
+          continue;
+        if (view.identity) {
+          view.movingAverage->update(binLevels);
+        } else {
+          gatherLevels(view);
+          view.movingAverage->update(view.levels);
+        }
+      }
+    }
+#endif
+
+    /**
+     * Snapshot of the levels of each view, after smoothing.
+     *
+     * @memberof SlidingDFT
+     */
+    void snapshotLevels() {
+      for (auto& view : views) {
+#ifndef DISABLE_MOVING_AVERAGE
+        auto movingAverage = view.movingAverage;
+        if (movingAverage != nullptr && movingAverage->averageWindow > 0) {
+          const unsigned viewBands = view.binIndex.size();
+          for (unsigned band = 0; band < viewBands; band++)
+            view.levels[band] = movingAverage->read(band);
+          continue;
+        }
+#endif
+        gatherLevels(view);
+      }
+    }
+
+  public:
+    unsigned sampleRate, bands;
+    // when the output is not averaged, only the levels after the last sample of the block are observable;
+    // use the (much cheaper) block-rate kernel in that case
+    bool blockRate = true;
+    // extra work a retuneGradually() may add to each process() call, relative to updating all the bins once
+    double retuneLoad = .25;
+
+    /**
+     * Creates an instance of SlidingDFT.
+     * @param tuning Tuning instance (a class derived from Tuning; for instance, PianoTuning).
+     * @param [maxAverageWindowInSeconds=0] Positive values are passed to MovingAverage implementation; negative values trigger FastMovingAverage implementation. Zero disables averaging.
+     * @memberof SlidingDFT
+     */
+    BasicSlidingDFT(const std::shared_ptr<Tuning> tuning, const double maxAverageWindowInSeconds = 0.) {
+      sampleRate = tuning->sampleRate;
+      bands = tuning->bands;
+      addTuning(tuning, maxAverageWindowInSeconds);
+    }
+
+    /**
+     * Adds another Tuning (view) over the same input history.
+     * The bins with the same k & N are shared between the views, so only the missing ones add to the cost.
+     *
+     * @param tuning Tuning instance; must have the same sample rate as the first one.
+     * @param [maxAverageWindowInSeconds=0] Same as in the constructor; each view has its own moving average.
+     * @return Index of the new view (the one from the constructor is 0).
+     * @memberof SlidingDFT
+     */
+    unsigned addTuning(const std::shared_ptr<Tuning> tuning, const double maxAverageWindowInSeconds = 0.) {
+      if (tuning->sampleRate != sampleRate)
+        throw std::invalid_argument("all the tunings must have the same sample rate");
+
+      const auto mapping = tuning->mapping();
+      unsigned maxN = 0;
+      for (auto band : mapping)
+        maxN = std::max(maxN, band.N);
+      fitRingBuffer(maxN);
+
+      View view;
+      view.tuning = tuning;
+      view.binIndex.reserve(mapping.size());
+      for (auto band : mapping)
+        view.binIndex.push_back(findOrCreateBin(band.k, band.N));
+      view.levels.resize(mapping.size());
+      updateIdentity(view);
+
+#ifndef DISABLE_MOVING_AVERAGE
+      if (maxAverageWindowInSeconds > 0.) {
+        view.movingAverage = std::make_shared<HeavyMovingAverage>(
+          tuning->bands,
+          sampleRate,
+          std::round(sampleRate * maxAverageWindowInSeconds)
+        );
+      } else if (maxAverageWindowInSeconds < 0.) {
+        view.movingAverage = std::make_shared<FastMovingAverage>(
+          tuning->bands,
+          sampleRate
+        );
+      } else {
+        view.movingAverage = nullptr;
+      }
+#endif
+
+      views.push_back(view);
+      return views.size() - 1;
+    }
+
+    /**
+     * Swaps the tuning of a view on-fly, without losing the warm state: the sample history is kept,
+     * the bins that the new tuning does not share are primed from it (instead of starting from silence),
+     * and the moving average of the view carries on.
+     *
+     * @param view Index of the view.
+     * @param tuning New Tuning instance; must have the same sample rate & number of bands.
+     * @memberof SlidingDFT
+     */
+    void retune(const unsigned view, const std::shared_ptr<Tuning> tuning) {
+      View& target = views.at(view);
+      const auto mapping = retuneMapping(target, tuning);
+      pending = nullptr;
+
+      target.tuning = tuning;
+      for (unsigned band = 0; band < mapping.size(); band++)
+        target.binIndex[band] = findOrCreateBin(mapping[band].k, mapping[band].N);
+      pruneBins();
+    }
+
+    /**
+     * Same as retune(), but spread over the next process() calls, so that no single block pays for priming
+     * all the new bins (up to N sample updates each) at once. The bands move over one by one, each as soon as
+     * its new bin is primed; viewTuning() changes once all of them did. The extra work per process() call is
+     * bounded by retuneLoad. A new retune (of either kind) replaces the pending one.
+     *
+     * @param view Index of the view.
+     * @param tuning New Tuning instance; must have the same sample rate & number of bands.
+     * @memberof SlidingDFT
+     */
+    void retuneGradually(const unsigned view, const std::shared_ptr<Tuning> tuning) {
+      View& target = views.at(view);
+      pending = std::make_unique<PendingRetune>();
+      pending->mapping = retuneMapping(target, tuning);
+      pending->view = view;
+      pending->tuning = tuning;
+      // the bands whose bins already exist move right away
+      advanceRetune(0, 0);
+    }
+
+    /**
+     * Whether a retuneGradually() is still in progress.
+     *
+     * @memberof SlidingDFT
+     */
+    bool retuning() const {
+      return pending != nullptr;
+    }
+
+    /**
+     * The Tuning instance of the view.
+     *
+     * @memberof SlidingDFT
+     */
+    std::shared_ptr<Tuning> viewTuning(const unsigned view) const {
+      return views.at(view).tuning;
+    }
+
+    /**
+     * The DFTBin behind a band of the view (shared with the other views that have the same k & N).
+     *
+     * @memberof SlidingDFT
+     */
+    const std::shared_ptr<DFTBin>& viewBin(const unsigned view, const unsigned band) const {
+      return bins[views.at(view).binIndex.at(band)];
+    }
+
+    /**
+     * Number of views (tunings) sharing this instance.
+     *
+     * @memberof SlidingDFT
+     */
+    unsigned viewCount() const {
+      return views.size();
+    }
+
+    /**
+     * Number of distinct DFTBin instances updated for every sample.
+     *
+     * @memberof SlidingDFT
+     */
+    unsigned binCount() const {
+      return bins.size();
+    }
+
+    /**
+     * Number of bands of the view.
+     *
+     * @memberof SlidingDFT
+     */
+    unsigned viewBands(const unsigned view) const {
+      return views.at(view).binIndex.size();
+    }
+
+    /**
+     * Adjust the moving average window size of the view; used by the next process() call.
+     * (the one passed to process() is the window of the view 0)
+     *
+     * @memberof SlidingDFT
+     */
+    void averageWindowInSeconds(const unsigned view, const double value) {
+      views.at(view).averageWindowInSeconds = value;
+    }
+
+    /**
+     * Snapshot of the levels of the view, as of the last process() call.
+     *
+     * @memberof SlidingDFT
+     */
+    const float* viewLevels(const unsigned view) const {
+      return views.at(view).levels.data();
+    }
+
+    /**
+     * Sheds load from the top of the spectrum: the bins centered above the frequency are not updated anymore
+     * (their levels read 0) until the limit is raised again. Then, they are primed from the history,
+     * so they are right from the very next process() call.
+     *
+     * @param frequency Highest frequency to analyze, in Hz; 0 analyzes everything.
+     * @memberof SlidingDFT
+     */
+    void bandLimit(const double frequency) {
+      bandLimitFrequency = frequency;
+      for (unsigned index = 0; index < bins.size(); index++) {
+        DFTBin& bin = *bins[index];
+        const bool suspend = isAboveBandLimit(bin);
+        if (binSuspended[index] && !suspend) {
+          // whatever the bin had is stale by now; start it over from the history (keeping the bin identity)
+          const double referenceAmplitude = bin.referenceAmplitude;
+          bin = DFTBin(static_cast<unsigned>(bin.k), static_cast<unsigned>(bin.N));
+          bin.referenceAmplitude = referenceAmplitude;
+          prime(bin);
+          binLevels[index] = bin.normalizedAmplitudeSpectrum();
+        } else if (suspend) {
+          binLevels[index] = 0.f;
+        }
+        binSuspended[index] = suspend;
+      }
+    }
+
+    /**
+     * The current limit set by bandLimit() (0 when everything is analyzed).
+     *
+     * @memberof SlidingDFT
+     */
+    double bandLimit() const {
+      return bandLimitFrequency;
+    }
+
+    /**
+     * Back to silence, as if the instance was just created, but without reallocating anything:
+     * the history, the bins & the moving averages are zeroed (in the time it takes to write their state).
+     * The tunings, the bins & the bandLimit() stay; so does the memory. Handy to analyze many inputs in a row.
+     *
+     * @memberof SlidingDFT
+     */
+    void reset() {
+      ringBuffer->reset();
+      // the bin being primed for a retuneGradually() starts over, from the silence
+      if (pending != nullptr)
+        pending->bin = nullptr;
+      for (auto& bin : bins)
+        bin->reset();
+      std::fill(binLevels.begin(), binLevels.end(), 0.f);
+      for (auto& view : views) {
+        std::fill(view.levels.begin(), view.levels.end(), 0.f);
+#ifndef DISABLE_MOVING_AVERAGE
+        if (view.movingAverage != nullptr)
+          view.movingAverage->reset();
+#endif
+      }
+    }
+
+    /**
+     * Number of the most recent samples kept in the history, hence the longest window query() can evaluate.
+     *
+     * @memberof SlidingDFT
+     */
+    unsigned historyLength() const {
+      return ringBuffer->size;
+    }
+
+    /**
+     * Evaluates a one-off level at any frequency & window length, over the samples already in the history.
+     * Nothing is added to the per-sample updates: the cost (about N operations) is paid only by this call.
+     *
+     * @param frequency Frequency, in Hz; not restricted to the multiples of the bandwidth.
+     * @param N Window length, in samples; up to historyLength().
+     * @return Same as DFTBin::normalizedAmplitudeSpectrum() of a bin over the last N samples.
+     * @memberof SlidingDFT
+     * @par EXAMPLE
+     * // is there a sympathetic resonance one octave above A4?
+     * const double level = slidingDFT.query(880., 4410);
+     */
+    double query(const double frequency, const unsigned N) {
+      float level;
+      query(&frequency, &N, 1, &level);
+      return level;
+    }
+
+    /**
+     * Batched query(): the queries are evaluated together, over one copy of the history, interleaved
+     * by GoertzelBank so that the loop vectorizes.
+     *
+     * @param frequencies Frequency of each query, in Hz.
+     * @param windowLengths Window length of each query, in samples; up to historyLength().
+     * @param count Number of queries.
+     * @param levels Output: the level of each query.
+     * @memberof SlidingDFT
+     */
+    void query(const double frequencies[], const unsigned windowLengths[], const unsigned count, float levels[]) {
+      if (count == 0)
+        return;
+      std::vector<unsigned> order(count), N(windowLengths, windowLengths + count);
+      std::vector<double> coeff(count);
+      unsigned longest = 0;
+      for (unsigned i = 0; i < count; i++) {
+        if (N[i] == 0)
+          throw std::invalid_argument("query() window is empty");
+        if (N[i] > historyLength())
+          throw std::invalid_argument(
+            "query() window of " + std::to_string(N[i]) + " samples exceeds the history of "
+            + std::to_string(historyLength()) + " samples"
+          );
+        order[i] = i;
+        coeff[i] = GoertzelBank::coefficient(frequencies[i], sampleRate);
+        longest = std::max(longest, N[i]);
+      }
+      std::stable_sort(order.begin(), order.end(), [&N](const unsigned a, const unsigned b) {
+        return N[a] > N[b];
+      });
+
+      queryWindow.resize(longest);
+      ringBuffer->readChunk(longest - 1, longest, queryWindow.data());
+      goertzel.evaluate(queryWindow.data(), longest, order, N, coeff, levels);
+    }
+
+    /**
+     * Process a batch of samples.
+     *
+     * @param samples Array with the batch of samples to process. Value range is irrelevant (can be from -1.0 to 1.0 or 0 to 255 or whatever, as long as it is consistent).
+     * @param [averageWindowInSeconds=0] Adjust the moving average window size (of the view 0).
+     * @return Snapshot of the *squared* levels (of the view 0) after processing all the samples. Value range is between 0.0 and 1.0. Depending on the application, you might need sqrt() of the level values (for visualization purposes it is actually better as is).
+     * @memberof SlidingDFT
+     */
+    const float* process(const float samples[], const size_t samplesLength, const double averageWindowInSeconds = 0.) {
+      views[0].averageWindowInSeconds = averageWindowInSeconds;
+
+      bool averaging = false;
+#ifndef DISABLE_MOVING_AVERAGE
+      for (auto& view : views) {
+        auto movingAverage = view.movingAverage;
+        if (movingAverage == nullptr)
+          continue;
+        movingAverage->averageWindowInSeconds(view.averageWindowInSeconds);
+        // a zero-sized window is a pass-through; only a pending resize needs the per-sample levels
+        if (movingAverage->averageWindow != 0 || movingAverage->targetAverageWindow != 0)
+          averaging = true;
+      }
+#endif
+
+      if (blockRate && !averaging) {
+        processBlock(samples, samplesLength);
+#ifndef DISABLE_MOVING_AVERAGE
+        updateMovingAverages();
+#endif
+        if (pending != nullptr)
+          advanceRetune(samplesLength, retuneBudget(samplesLength));
+        snapshotLevels();
+        return views[0].levels.data();
+      }
+
+      // store in the ring buffer & process
+      for (unsigned i = 0; i < samplesLength; i++) {
+        const float currentSample = ringBuffer->quantize(samples[i]);
+        ringBuffer->write(currentSample);
+
+        // without averaging, the levels are only observable after the last sample
+        const bool observable = averaging || i == samplesLength - 1;
+
+        for (unsigned index = 0; index < bins.size(); index++) {
+          if (binSuspended[index])
+            continue;
+          DFTBin *bin = bins[index].get();
+          const float previousSample = ringBuffer->read(bin->N);
+          bin->update(previousSample, currentSample);
+          if (observable)
+            binLevels[index] = bin->normalizedAmplitudeSpectrum();
+          // binLevels[index] = bin->logarithmicUnitDecibels();
+        }
+
+#ifndef DISABLE_MOVING_AVERAGE
+        if (observable)
+          updateMovingAverages();
+#endif
+      }
+
+      if (pending != nullptr)
+        advanceRetune(samplesLength, retuneBudget(samplesLength));
+      snapshotLevels();
+      return views[0].levels.data();
+    }
+};
+
+// the sample history type is a template parameter, so that both kinds can be used (& compared) in the same program;
+// the memory-constrained builds can make the compact one the default
+#ifdef COMPACT_HISTORY
+using SlidingDFT = BasicSlidingDFT<CompactRingBuffer>;
+#else
+using SlidingDFT = BasicSlidingDFT<RingBuffer>;
+#endif
+
+/**
+ * Makes the low keys respond quickly: each band whose window (N) is longer than the allowed latency
+ * is paired with a short auxiliary bin at the same frequency, spanning just a few periods of the fundamental.
+ * The auxiliary bins are an extra view of the same SlidingDFT, so they share the history (and the bins
+ * that are short enough already are not duplicated). When the level of an auxiliary bin jumps over
+ * the threshold (and is higher than the ones of its neighbours, which also catch some of the energy),
+ * the band lights up right away; that boost fades out while the long window fills up,
+ * leaving the long bin to settle on the correct key.
+ *
+ * @class OnsetBooster
+ * @par EXAMPLE
+ * auto slidingDFT = SlidingDFT(std::make_shared<PianoTuning>(44100), -1.);
+ * auto booster = OnsetBooster(slidingDFT);
+ * // for every processed block
+ * slidingDFT.process(input, 128, 0.04);
+ * const float *output = booster.update(slidingDFT, 128);
+ */
+class OnsetBooster {
+  private:
+    class ShortTuning : public Tuning {
+      public:
+        std::vector<tuningValues> values;
+
+        ShortTuning(const unsigned sampleRate_, const std::vector<tuningValues>& values_)
+          : Tuning{ sampleRate_, static_cast<unsigned>(values_.size()) }, values(values_)
+        {}
+
+        const std::vector<tuningValues> mapping() {
+          return values;
+        }
+    };
+
+    std::shared_ptr<Tuning> tuning;       // the one of the boosted view that the auxiliary bins are paired with
+    std::shared_ptr<Tuning> shortTuning;  // the auxiliary tuning that goes with it
+    std::vector<unsigned> windowLength;
+    std::vector<bool> paired;
+    std::vector<unsigned> elapsed;    // samples since the onset; the boost is over once it reaches N
+    std::vector<float> previousShort;
+    std::vector<float> levels;
+    unsigned maxN, cycles, radius;
+
+    // pairs the bands of the current tuning of the view with the auxiliary bins
+    void pair(const SlidingDFT& sdft) {
+      tuning = sdft.viewTuning(view);
+      const auto mapping = tuning->mapping();
+      std::vector<Tuning::tuningValues> shortMapping;
+      windowLength.clear();
+      paired.clear();
+      for (auto band : mapping) {
+        windowLength.push_back(band.N);
+        if (band.N > maxN && band.k > cycles) {
+          // same center frequency (k / N), shorter window
+          paired.push_back(true);
+          shortMapping.push_back({ cycles, static_cast<unsigned>(std::round(static_cast<double>(band.N) * cycles / band.k)) });
+        } else {
+          paired.push_back(false);
+          shortMapping.push_back(band);
+        }
+      }
+      shortTuning = std::make_shared<ShortTuning>(sdft.sampleRate, shortMapping);
+      previousShort.resize(mapping.size());
+      levels.resize(mapping.size());
+      reset();
+    }
+
+  public:
+    unsigned view, shortView;
+    float threshold = .2;   // level of the auxiliary bin that counts as an onset
+
+    /**
+     * Creates an instance of OnsetBooster & adds the auxiliary view to the SlidingDFT.
+     * @param sdft SlidingDFT instance.
+     * @param [view_=0] View to boost.
+     * @param [maxLatency=0.05] Bands with longer windows (in seconds) get paired.
+     * @param [cycles=4] Length of the auxiliary windows, in periods of the fundamental; fewer cycles light up sooner, but more often on the neighbouring keys.
+     * @memberof OnsetBooster
+     */
+    OnsetBooster(SlidingDFT& sdft, const unsigned view_ = 0, const double maxLatency = .05, const unsigned cycles_ = 4)
+      : maxN(std::round(maxLatency * sdft.sampleRate)), cycles(cycles_), view(view_) {
+      if (cycles == 0)
+        throw std::invalid_argument("cycles must be positive");
+
+      pair(sdft);
+      shortView = sdft.addTuning(shortTuning);
+      // distance to the first zero of the response of an auxiliary bin, in semitones (that is, PianoTuning bands)
+      radius = std::ceil(12. * std::log2(1. + 1. / cycles));
+    }
+
+    /**
+     * Forget the onsets in progress; call along with SlidingDFT::reset().
+     *
+     * @memberof OnsetBooster
+     */
+    void reset() {
+      elapsed = windowLength;
+      std::fill(previousShort.begin(), previousShort.end(), 0.f);
+    }
+
+    /**
+     * Combines the long & short levels; call after each SlidingDFT::process().
+     * When the view was retuned (for instance, by PitchCalibrator), the auxiliary view follows, over the next
+     * blocks (see SlidingDFT::retuneGradually()); the levels are not boosted until it caught up.
+     *
+     * @param sdft SlidingDFT instance.
+     * @param samplesLength Number of samples processed since the previous call.
+     * @return Levels of the view, boosted at the onsets.
+     * @memberof OnsetBooster
+     */
+    const float* update(SlidingDFT& sdft, const unsigned samplesLength) {
+      // only one retune is in progress at a time; a newer one of the view replaces the one of the auxiliary view
+      if (!sdft.retuning()) {
+        if (sdft.viewTuning(view) != tuning) {
+          pair(sdft);
+          sdft.retuneGradually(shortView, shortTuning);
+        } else if (sdft.viewTuning(shortView) != shortTuning) {
+          sdft.retuneGradually(shortView, shortTuning);
+        }
+      }
+
+      const float *longLevels = sdft.viewLevels(view);
+      const float *shortLevels = sdft.viewLevels(shortView);
+      const unsigned bands = levels.size();
+      const bool boosting = sdft.viewTuning(shortView) == shortTuning;
+
+      for (unsigned band = 0; band < bands; band++) {
+        levels[band] = longLevels[band];
+        if (!paired[band] || !boosting)
+          continue;
+
+        const float level = shortLevels[band];
+        if (level >= threshold && previousShort[band] < threshold)
+          elapsed[band] = 0;
+        else
+          elapsed[band] = std::min(windowLength[band], elapsed[band] + samplesLength);
+        previousShort[band] = level;
+
+        // the auxiliary bins are wide, so a tone excites the neighbouring ones, too; only light up the strongest
+        bool peak = true;
+        const unsigned from = band > radius ? band - radius : 0;
+        const unsigned to = std::min(bands - 1, band + radius);
+        for (unsigned neighbour = from; neighbour <= to && peak; neighbour++)
+          peak = neighbour == band || level >= shortLevels[neighbour];
+
+        if (peak) {
+          const float fade = 1.f - static_cast<float>(elapsed[band]) / windowLength[band];
+          levels[band] = std::max(levels[band], level * fade);
+        }
+      }
+
+      return levels.data();
+    }
+};
+
+/**
+ * Alternative to SlidingDFT for the low output rates: instead of sliding every bin by every sample,
+ * evaluates the DFT of each band over its window (the last N samples) once per process() call,
+ * with the Goertzel algorithm. Each call costs the sum of N over the bands, however many samples
+ * it was given; SlidingDFT costs the number of bands times the number of samples.
+ * The levels are the same as the ones of SlidingDFT without the moving average.
+ *
+ * @class HopDFT
+ * @par EXAMPLE
+ * auto tuning = std::make_shared<PianoTuning>(44100);
+ * // about 10 frames per second
+ * const unsigned hopSize = 4410;
+ * if (HopDFT::preferred(tuning, hopSize)) {
+ *   auto hopDFT = HopDFT(tuning);
+ *   // fill the input buffer with hopSize samples
+ *   const float *output = hopDFT.process(input, hopSize);
+ * }
+ */
+class HopDFT {
+  private:
+    std::vector<unsigned> order; // band indexes, longest N first, so that the interleaved bands have similar N
+    std::vector<unsigned> windowLength;
+    std::vector<double> goertzelCoeff;
+    GoertzelBank goertzel;
+    std::unique_ptr<RingBuffer> ringBuffer;
+    std::vector<float> window;
+    std::vector<float> levels;
+    unsigned maxN = 0;
+
+  public:
+    // one sample of a band in process(), relative to one sample of a bin in SlidingDFT::process();
+    // measured on x86-64: about .8 with the baseline SSE2 (what the Makefile builds), 1.1 with AVX2,
+    // where SlidingDFT gains more; the other targets were not measured & take the baseline value
+#ifdef __AVX2__
+    static constexpr double relativeCost = 1.1;
+#else
+    static constexpr double relativeCost = .8;
+#endif
+
+    unsigned sampleRate, bands;
+
+    /**
+     * Creates an instance of HopDFT.
+     * @param tuning Tuning instance (a class derived from Tuning; for instance, PianoTuning).
+     * @memberof HopDFT
+     */
+    HopDFT(const std::shared_ptr<Tuning> tuning) {
+      sampleRate = tuning->sampleRate;
+      bands = tuning->bands;
+
+      const auto mapping = tuning->mapping();
+      for (auto band : mapping) {
+        windowLength.push_back(band.N);
+        goertzelCoeff.push_back(2. * cos(2. * M_PI * band.k / band.N));
+        maxN = std::max(maxN, band.N);
+      }
+
+      order.resize(bands);
+      for (unsigned band = 0; band < bands; band++)
+        order[band] = band;
+      std::stable_sort(order.begin(), order.end(), [this](const unsigned a, const unsigned b) {
+        return windowLength[a] > windowLength[b];
+      });
+
+      ringBuffer = std::make_unique<RingBuffer>(maxN);
+      window.resize(maxN);
+      levels.resize(bands);
+    }
+
+    /**
+     * Estimates the hop size (samples per process() call) above which HopDFT is cheaper than SlidingDFT.
+     *
+     * @param tuning Tuning instance.
+     * @memberof HopDFT
+     */
+    static double crossover(const std::shared_ptr<Tuning> tuning) {
+      const auto mapping = tuning->mapping();
+      double sumN = 0., maxN = 0.;
+      for (auto band : mapping) {
+        sumN += band.N;
+        maxN = std::max(maxN, static_cast<double>(band.N));
+      }
+      // HopDFT: relativeCost * (sum of N) + the window copy; SlidingDFT: bands * hop size
+      return (relativeCost * sumN + maxN) / mapping.size();
+    }
+
+    /**
+     * Picks the cheaper engine for the tuning & the output rate (SlidingDFT is the only one that can do the moving average, though).
+     *
+     * @param tuning Tuning instance.
+     * @param hopSize Samples per output frame (sample rate divided by the output rate).
+     * @return true when HopDFT is expected to be faster than SlidingDFT.
+     * @memberof HopDFT
+     */
+    static bool preferred(const std::shared_ptr<Tuning> tuning, const size_t hopSize) {
+      return hopSize > crossover(tuning);
+    }
+
+    /**
+     * Back to silence, as if the instance was just created (without reallocating anything).
+     *
+     * @memberof HopDFT
+     */
+    void reset() {
+      ringBuffer->reset();
+    }
+
+    /**
+     * Process a batch of samples.
+     *
+     * @param samples Array with the batch of samples to process.
+     * @param samplesLength Number of samples in the batch.
+     * @return Snapshot of the *squared* levels after processing all the samples (same as SlidingDFT::process()).
+     * @memberof HopDFT
+     */
+    const float* process(const float samples[], const size_t samplesLength) {
+      for (size_t i = 0; i < samplesLength; i++)
+        ringBuffer->write(samples[i]);
+
+      // the longest window, oldest sample first; the shorter windows are its tails
+      ringBuffer->readChunk(maxN - 1, maxN, window.data());
+      goertzel.evaluate(window.data(), maxN, order, windowLength, goertzelCoeff, levels.data());
+
+      return levels.data();
+    }
+};
+
+/**
+ * Turns the levels from SlidingDFT::process() into the final output values, in one branchless pass
+ * (that the compiler can vectorize): optional square root or decibel scale, per-key gain,
+ * per-key noise gate, clamping to [0.0, 1.0] & quantization.
+ *
+ * @class OutputTransform
+ * @par EXAMPLE
+ * auto transform = OutputTransform(61, OutputTransform::SQUARE_ROOT, 0.05);
+ * // boost the lowest key a bit
+ * transform.gain[0] = 2.;
+ * uint8_t output[61];
+ * transform.apply(slidingDFT.process(input, 128, 0.04), output);
+ */
+class OutputTransform {
+  public:
+    enum Scale {
+      LINEAR,       // as is (the *squared* normalized amplitude)
+      SQUARE_ROOT,  // normalized amplitude
+      DECIBELS      // 10 * log10(level), mapped from [decibelsFloor, 0] to [0, 1]
+    };
+
+    unsigned bands;
+    Scale scale;
+    float decibelsFloor = -60.;
+    std::vector<float> gain;
+    std::vector<float> threshold;
+
+    /**
+     * Creates an instance of OutputTransform.
+     * @param bands_ Number of levels per frame.
+     * @param [scale_=LINEAR] Scale applied before the gain & the gate.
+     * @param [threshold_=0] Noise gate threshold for all keys; values that are not above it become 0.
+     * @memberof OutputTransform
+     */
+    OutputTransform(const unsigned bands_, const Scale scale_ = LINEAR, const float threshold_ = 0.)
+      : bands(bands_), scale(scale_), gain(bands_, 1.), threshold(bands_, threshold_)
+    {}
+
+    /**
+     * Fast log2() approximation (absolute error below 1e-5), vectorizable unlike the std::log2().
+     *
+     * @param x Positive, normal value.
+     * @memberof OutputTransform
+     */
+    static float fastLog2(const float x) {
+      uint32_t bits;
+      memcpy(&bits, &x, sizeof(bits));
+      const float exponent = static_cast<float>(static_cast<int32_t>(bits >> 23) - 127);
+      bits = (bits & 0x007fffff) | 0x3f800000;
+      float m;
+      memcpy(&m, &bits, sizeof(m));
+      // log2(m) = 2 / ln(2) * atanh(t), where t = (m - 1) / (m + 1) is in [0, 1/3) for m in [1, 2)
+      const float t = (m - 1.f) / (m + 1.f);
+      const float t2 = t * t;
+      return exponent
+        + static_cast<float>(2. / M_LN2) * t * (1.f + t2 * (1.f / 3.f + t2 * (1.f / 5.f + t2 * (1.f / 7.f + t2 * (1.f / 9.f)))));
+    }
+
+    /**
+     * Applies the transform.
+     *
+     * @param levels Input levels (bands values).
+     * @param output Destination (bands values); float output is not quantized.
+     * @memberof OutputTransform
+     */
+    void apply(const float levels[], float output[]) {
+      transform(levels, output, 1.f, false);
+    }
+
+    /**
+     * Applies the transform, quantizing to the range 0-255.
+     *
+     * @memberof OutputTransform
+     */
+    void apply(const float levels[], uint8_t output[]) {
+      transform(levels, output, 255.f, true);
+    }
+
+    /**
+     * Applies the transform, quantizing to the range 0-65535.
+     *
+     * @memberof OutputTransform
+     */
+    void apply(const float levels[], uint16_t output[]) {
+      transform(levels, output, 65535.f, true);
+    }
+
+  private:
+    template <typename T>
+    void transform(const float levels[], T output[], const float maximum, const bool quantize) {
+      const float *gains = gain.data();
+      const float *thresholds = threshold.data();
+      const float decibelsScale = 10.f * static_cast<float>(M_LN2 / M_LN10) / -decibelsFloor;
+      for (unsigned i = 0; i < bands; i++) {
+        float value = levels[i];
+        if (scale == SQUARE_ROOT)
+          value = std::sqrt(std::max(value, 0.f));
+        else if (scale == DECIBELS)
+          value = 1.f + decibelsScale * fastLog2(std::max(value, 1e-30f));
+        value *= gains[i];
+        value = value > thresholds[i] ? value : 0.f;
+        value = std::min(std::max(value, 0.f), 1.f);
+        output[i] = static_cast<T>(quantize ? value * maximum + .5f : value);
+      }
+    }
+};
+
+/**
+ * Fine pitch of every band, much finer than the bin spacing, at almost no extra cost: for a steady tone,
+ * the phase of the DFTBin value advances by the angular frequency of the tone per sample, so the phase
+ * difference between two consecutive process() calls gives the frequency of the strongest component
+ * within the band. The phase advance is only known modulo 2*pi, so it is unwrapped around the one expected
+ * at the center of the bin; the estimate is right as long as the tone is within sampleRate / (2 * samplesLength) Hz
+ * from the center (86Hz for blocks of 256 samples at 44100Hz: more than half a semitone up to C7).
+ * The other components that leak into the bin (the strong neighbours, the harmonics) wobble the phase a bit;
+ * measuring the advance over a span of several calls divides that error by the span, at the cost of reporting
+ * the average pitch over the span.
+ * Meaningful only for the bands with a significant level (see threshold).
+ *
+ * @class PitchTracker
+ * @par EXAMPLE
+ * auto tracker = PitchTracker();
+ * // for every processed block
+ * const float *levels = slidingDFT.process(input, 256);
+ * const float *cents = tracker.update(slidingDFT, 256);
+ * // cents[band]: deviation of the band from its nominal frequency, from -50 to 50 for a PianoTuning key
+ */
+class PitchTracker {
+  private:
+    std::shared_ptr<Tuning> tuning; // the one the nominal frequencies are from
+    std::vector<std::pair<unsigned, unsigned>> trackedBin; // k & N; a retuned band restarts the tracking
+    std::vector<unsigned> age; // updates since the band (re)started, up to the span
+    // the values of the bins after each of the last span updates (band-major rows), & the samples of each update
+    std::vector<double> historyRe, historyIm;
+    std::vector<unsigned> historyLength;
+    unsigned updates = 0;
+    std::vector<double> valueRe, valueIm;
+    std::vector<double> center; // angular frequency of each bin, per sample
+    std::vector<double> nominal; // frequency each band is expected to have, in Hz
+    std::vector<float> frequency, cents;
+    std::vector<uint8_t> valid;
+
+    void updateTuning(const SlidingDFT& sdft) {
+      tuning = sdft.viewTuning(view);
+      auto piano = std::dynamic_pointer_cast<PianoTuning>(tuning);
+      const unsigned bands = sdft.viewBands(view);
+      nominal.resize(bands);
+      for (unsigned band = 0; band < bands; band++) {
+        const auto bin = sdft.viewBin(view, band);
+        nominal[band] = piano != nullptr
+          ? piano->keyToFreq(band)
+          : bin->k * sdft.sampleRate / bin->N;
+      }
+    }
+
+    // wraps a phase into [-pi, pi]
+    static double wrap(const double phase) {
+      return phase - 2. * M_PI * std::round(phase / (2. * M_PI));
+    }
+
+  public:
+    unsigned view, span;
+    float threshold = 0.; // bands with lower levels report their nominal frequency & 0 cents
+
+    /**
+     * Creates an instance of PitchTracker.
+     * @param [view_=0] The view of SlidingDFT to track. The cents are relative to the keys of a PianoTuning,
+     * or to the center frequencies of the bins for other tunings.
+     * @param [span_=1] Number of update() calls the phase advance is measured over.
+     * @memberof PitchTracker
+     */
+    PitchTracker(const unsigned view_ = 0, const unsigned span_ = 1)
+      : view(view_), span(std::max(span_, 1u))
+    {}
+
+    /**
+     * Forget the previous phases; the next update() reports no deviation.
+     *
+     * @memberof PitchTracker
+     */
+    void reset() {
+      trackedBin.clear();
+    }
+
+    /**
+     * Estimates the pitch of every band; call after each SlidingDFT::process().
+     *
+     * @param sdft SlidingDFT instance.
+     * @param samplesLength Number of samples processed since the previous call.
+     * @return Deviation of each band from its nominal frequency, in cents.
+     * @memberof PitchTracker
+     */
+    const float* update(const SlidingDFT& sdft, const unsigned samplesLength) {
+      const unsigned bands = sdft.viewBands(view);
+      if (tuning != sdft.viewTuning(view) || nominal.size() != bands)
+        updateTuning(sdft);
+      if (trackedBin.size() != bands || historyLength.size() != span) {
+        trackedBin.assign(bands, std::make_pair(0u, 0u));
+        age.assign(bands, 0);
+        historyRe.assign(span * bands, 0.);
+        historyIm.assign(span * bands, 0.);
+        historyLength.assign(span, 0);
+        valueRe.resize(bands);
+        valueIm.resize(bands);
+        center.resize(bands);
+        frequency.resize(bands);
+        cents.resize(bands);
+        valid.resize(bands);
+      }
+
+      // gather the state of the bins, structure-of-arrays, so that the estimation below vectorizes
+      const float *levels = sdft.viewLevels(view);
+      for (unsigned band = 0; band < bands; band++) {
+        const auto& bin = sdft.viewBin(view, band);
+        const auto key = std::make_pair(static_cast<unsigned>(bin->k), static_cast<unsigned>(bin->N));
+        if (trackedBin[band] != key) {
+          trackedBin[band] = key;
+          age[band] = 0;
+        }
+        const std::complex<double> value = bin->value();
+        valueRe[band] = value.real();
+        valueIm[band] = value.imag();
+        center[band] = 2. * M_PI * bin->k / bin->N;
+        valid[band] = age[band] > 0 && levels[band] >= threshold;
+      }
+
+      // the row of the previous update, and the one of span updates ago (about to be overwritten)
+      const unsigned oldest = updates % span;
+      const unsigned previous = (updates + span - 1) % span;
+      double baseline = samplesLength;
+      for (unsigned row = 0; row < span; row++)
+        baseline += row != oldest ? historyLength[row] : 0;
+      const double *previousRe = historyRe.data() + previous * bands;
+      const double *previousIm = historyIm.data() + previous * bands;
+      double *oldestRe = historyRe.data() + oldest * bands;
+      double *oldestIm = historyIm.data() + oldest * bands;
+
+      const double length = samplesLength;
+      const double hzPerRadian = sdft.sampleRate / (2. * M_PI);
+      for (unsigned band = 0; band < bands; band++) {
+        // the value rotates by -omega per sample (the coefficient is e^-iq): the phase advance is arg(previous * conj(value))
+        const double re = previousRe[band] * valueRe[band] + previousIm[band] * valueIm[band];
+        const double im = previousIm[band] * valueRe[band] - previousRe[band] * valueIm[band];
+        double omega = center[band] + wrap(std::atan2(im, re) - center[band] * length) / length;
+
+        if (span > 1) {
+          // refined over the span, unwrapped around the advance that the estimate from the last call predicts
+          const double spanRe = oldestRe[band] * valueRe[band] + oldestIm[band] * valueIm[band];
+          const double spanIm = oldestIm[band] * valueRe[band] - oldestRe[band] * valueIm[band];
+          const double refined = omega + wrap(std::atan2(spanIm, spanRe) - omega * baseline) / baseline;
+          omega = age[band] >= span ? refined : omega;
+        }
+
+        frequency[band] = valid[band] ? omega * hzPerRadian : nominal[band];
+        cents[band] = valid[band] ? 1200. * std::log2(omega * hzPerRadian / nominal[band]) : 0.;
+        oldestRe[band] = valueRe[band];
+        oldestIm[band] = valueIm[band];
+        age[band] = std::min(age[band] + 1, span);
+      }
+
+      historyLength[oldest] = samplesLength;
+      updates++;
+      return cents.data();
+    }
+
+    /**
+     * Estimated frequency of each band, in Hz, as of the last update().
+     *
+     * @memberof PitchTracker
+     */
+    const float* frequencies() const {
+      return frequency.data();
+    }
+
+    /**
+     * Whether the band was actually measured by the last update() (tracked since the previous one & above the threshold).
+     *
+     * @memberof PitchTracker
+     */
+    bool measured(const unsigned band) const {
+      return valid.at(band) != 0;
+    }
+};
+
+/**
+ * Estimates the actual reference pitch (A4) of the instrument from the sustained notes,
+ * and retunes the SlidingDFT accordingly. The notes are measured with a PitchTracker.
+ *
+ * @class PitchCalibrator
+ * @par EXAMPLE
+ * auto calibrator = PitchCalibrator();
+ * // for every processed block
+ * slidingDFT.process(input, 128, 0.04);
+ * calibrator.update(slidingDFT, 128);
+ * if (calibrator.calibrate(slidingDFT))
+ *   std::cerr << "retuned to A4=" << calibrator.pitchFork << "Hz" << std::endl;
+ */
+class PitchCalibrator {
+  private:
+    PitchTracker tracker;
+    std::vector<unsigned> sustainedBlocks;
+    double weightedCents = 0.;
+    double weight = 0.;
+
+  public:
+    unsigned view;
+    float threshold = .4;           // minimum level of a note to be measured
+    double sustain = .1;            // seconds a note must be held before it is measured
+    double evidence = 2.;           // level-weighted seconds of measurements before proposing a correction
+    double minimumCorrection = 1.;  // smaller corrections (in cents) are ignored
+    double pitchFork = 0.;          // the most recent calibration result
+
+    /**
+     * Creates an instance of PitchCalibrator.
+     * @param [view_=0] The view of SlidingDFT to calibrate; its Tuning must be a PianoTuning.
+     * @memberof PitchCalibrator
+     */
+    PitchCalibrator(const unsigned view_ = 0)
+      : tracker(view_), view(view_)
+    {}
+
+    /**
+     * Forget all the measurements.
+     *
+     * @memberof PitchCalibrator
+     */
+    void reset() {
+      tracker.reset();
+      sustainedBlocks.clear();
+      weightedCents = 0.;
+      weight = 0.;
+    }
+
+    /**
+     * Measures the sustained notes; call after each SlidingDFT::process().
+     *
+     * @param sdft SlidingDFT instance.
+     * @param samplesLength Number of samples processed since the previous call.
+     * @memberof PitchCalibrator
+     */
+    void update(const SlidingDFT& sdft, const unsigned samplesLength) {
+      auto tuning = std::dynamic_pointer_cast<PianoTuning>(sdft.viewTuning(view));
+      if (tuning == nullptr)
+        throw std::invalid_argument("PitchCalibrator requires a PianoTuning");
+
+      const unsigned bands = sdft.viewBands(view);
+      const float *levels = sdft.viewLevels(view);
+      tracker.view = view;
+      const float *deviation = tracker.update(sdft, samplesLength);
+      if (sustainedBlocks.size() != bands)
+        sustainedBlocks.assign(bands, 0);
+      // while the bands move to the new tuning, they are measured against different ones; wait for the end
+      if (sdft.retuning()) {
+        std::fill(sustainedBlocks.begin(), sustainedBlocks.end(), 0);
+        return;
+      }
+
+      const double seconds = static_cast<double>(samplesLength) / sdft.sampleRate;
+      const unsigned sustainBlocks = std::ceil(sustain / seconds);
+      for (unsigned band = 0; band < bands; band++) {
+        if (levels[band] < threshold) {
+          sustainedBlocks[band] = 0;
+          continue;
+        }
+        if (++sustainedBlocks[band] <= sustainBlocks || !tracker.measured(band))
+          continue;
+
+        const double cents = deviation[band];
+        if (std::fabs(cents) >= 50.)
+          continue; // closer to a neighbouring key; not a tone of this one
+
+        weightedCents += cents * levels[band] * seconds;
+        weight += levels[band] * seconds;
+      }
+    }
+
+    /**
+     * Average deviation of the measured notes from the current tuning.
+     *
+     * @memberof PitchCalibrator
+     */
+    double cents() const {
+      return weight > 0. ? weightedCents / weight : 0.;
+    }
+
+    /**
+     * Whether there is enough evidence for a correction.
+     *
+     * @memberof PitchCalibrator
+     */
+    bool ready() const {
+      return weight >= evidence && std::fabs(cents()) >= minimumCorrection;
+    }
+
+    /**
+     * Retunes the view of SlidingDFT when ready(), over the next blocks, keeping the warm state
+     * (see SlidingDFT::retuneGradually()); nothing is measured until the retune is complete.
+     *
+     * @param sdft SlidingDFT instance.
+     * @return true when the retune started.
+     * @memberof PitchCalibrator
+     */
+    bool calibrate(SlidingDFT& sdft) {
+      if (sdft.retuning() || !ready())
+        return false;
+
+      auto tuning = std::dynamic_pointer_cast<PianoTuning>(sdft.viewTuning(view));
+      pitchFork = tuning->pitchFork() * std::pow(2., cents() / 1200.);
+      sdft.retuneGradually(view, std::make_shared<PianoTuning>(
+        tuning->sampleRate,
+        tuning->bands,
+        tuning->referenceKey(),
+        pitchFork,
+        tuning->tolerance()
+      ));
+      reset();
+      return true;
     }
 };
@@ -0,0 +1,370 @@
+/**
+ * @file realtime.hpp
+ * @brief Real-time execution helpers for the CLI: memory locking, CPU pinning, SCHED_FIFO, deadline miss accounting & a graceful interrupt (Linux-specific).
+ * @see http://github.com/creaktive/pianolizer
+ * @author Stanislaw Pusep
+ * @copyright MIT
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <alloca.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+/**
+ * Best-effort switches for the real-time execution. None of them is fatal: without the privileges
+ * (CAP_IPC_LOCK, CAP_SYS_NICE or the matching RLIMIT_MEMLOCK/RLIMIT_RTPRIO), the call fails,
+ * the reason ends up in the error member and the process keeps running as before.
+ *
+ * @class RealTime
+ * @par EXAMPLE
+ * RealTime rt;
+ * if (!rt.lockMemory())
+ *   std::cerr << rt.error << std::endl;
+ */
+class RealTime {
+  public:
+    std::string error;
+
+    /**
+     * Locks all the current & future pages of the process in RAM, so the DSP loop never page-faults.
+     *
+     * @return true on success.
+     * @memberof RealTime
+     */
+    bool lockMemory() {
+      if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+        return true;
+      error = std::string("mlockall: ") + strerror(errno);
+      return false;
+    }
+
+    /**
+     * Touches a chunk of the stack, so that it is faulted in (and locked) before the DSP loop starts.
+     *
+     * @param [bytes=262144] How much of the stack to pre-fault.
+     * @memberof RealTime
+     */
+    static void prefaultStack(const size_t bytes = 256 * 1024) {
+      volatile char *chunk = static_cast<volatile char*>(alloca(bytes));
+      for (size_t i = 0; i < bytes; i += 4096)
+        chunk[i] = 0;
+    }
+
+    /**
+     * Pins the calling thread to a CPU core.
+     *
+     * @param core Core index, starting from 0.
+     * @return true on success.
+     * @memberof RealTime
+     */
+    bool pinToCore(const unsigned core) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(core, &set);
+      const int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+      if (result == 0)
+        return true;
+      error = "pthread_setaffinity_np(" + std::to_string(core) + "): " + strerror(result);
+      return false;
+    }
+
+    /**
+     * Switches the calling thread to the SCHED_FIFO policy.
+     *
+     * @param priority From 1 to 99.
+     * @return true on success.
+     * @memberof RealTime
+     */
+    bool setFifoPriority(const int priority) {
+      sched_param param;
+      memset(&param, 0, sizeof(param));
+      param.sched_priority = priority;
+      const int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+      if (result == 0)
+        return true;
+      error = "pthread_setschedparam(SCHED_FIFO, " + std::to_string(priority) + "): " + strerror(result);
+      return false;
+    }
+};
+
+/**
+ * Turns SIGINT & SIGTERM into a flag for the main loop to check, instead of the termination on the spot,
+ * so that the outputs (archives, captures, shared memory objects) get closed properly on the way out.
+ * The blocking reads are interrupted (no SA_RESTART), so the loop gets to check the flag right away.
+ *
+ * @class Interrupt
+ * @par EXAMPLE
+ * Interrupt::install();
+ * while (!Interrupt::requested() && (len = fread(buffer, sizeof(float), 256, stdin)) > 0)
+ *   archive.write(analyze(buffer, len));
+ * archive.close();
+ */
+class Interrupt {
+  private:
+    static volatile sig_atomic_t& flag() {
+      static volatile sig_atomic_t value = 0;
+      return value;
+    }
+
+    static void handler(int) {
+      flag() = 1;
+    }
+
+  public:
+    /**
+     * Installs the handler for SIGINT & SIGTERM.
+     *
+     * @memberof Interrupt
+     */
+    static void install() {
+      struct sigaction action;
+      memset(&action, 0, sizeof(action));
+      action.sa_handler = handler;
+      sigaction(SIGINT, &action, nullptr);
+      sigaction(SIGTERM, &action, nullptr);
+    }
+
+    /**
+     * Whether SIGINT or SIGTERM arrived since install().
+     *
+     * @memberof Interrupt
+     */
+    static bool requested() {
+      return flag() != 0;
+    }
+};
+
+/**
+ * Measures how long each block takes to process, against the real-time budget of the block
+ * (block size divided by the sample rate). Every block that goes over the budget is a deadline miss.
+ *
+ * @class DeadlineMonitor
+ * @par EXAMPLE
+ * auto monitor = DeadlineMonitor(256, 44100);
+ * // for every block
+ * monitor.start();
+ * // ...process the block...
+ * if (monitor.stop())
+ *   std::cerr << "deadline miss!" << std::endl;
+ */
+class DeadlineMonitor {
+  private:
+    std::chrono::steady_clock::time_point started;
+
+  public:
+    double budget; // seconds
+    unsigned long blocks = 0;
+    unsigned long misses = 0;
+    double worst = 0.;
+    double total = 0.;
+    double last = 0.;
+
+    /**
+     * Creates an instance of DeadlineMonitor.
+     * @param blockSize Samples per block.
+     * @param sampleRate Samples per second.
+     * @memberof DeadlineMonitor
+     */
+    DeadlineMonitor(const unsigned blockSize, const unsigned sampleRate)
+      : budget(static_cast<double>(blockSize) / sampleRate)
+    {}
+
+    /**
+     * Marks the start of the block processing.
+     *
+     * @memberof DeadlineMonitor
+     */
+    void start() {
+      started = std::chrono::steady_clock::now();
+    }
+
+    /**
+     * Marks the end of the block processing.
+     *
+     * @return true when the block missed the deadline.
+     * @memberof DeadlineMonitor
+     */
+    bool stop() {
+      const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+      return record(elapsed.count());
+    }
+
+    /**
+     * Accounts for a block that took that long.
+     *
+     * @param elapsed Processing time, in seconds.
+     * @return true when the block missed the deadline.
+     * @memberof DeadlineMonitor
+     */
+    bool record(const double elapsed) {
+      blocks++;
+      total += elapsed;
+      last = elapsed;
+      if (elapsed > worst)
+        worst = elapsed;
+      if (elapsed <= budget)
+        return false;
+      misses++;
+      return true;
+    }
+
+    /**
+     * Fraction of the budget used, on average.
+     *
+     * @memberof DeadlineMonitor
+     */
+    double load() const {
+      return blocks ? total / (blocks * budget) : 0.;
+    }
+
+    /**
+     * Human-readable summary.
+     *
+     * @memberof DeadlineMonitor
+     */
+    std::string report() const {
+      char buffer[256];
+      snprintf(
+        buffer,
+        sizeof(buffer),
+        "%lu of %lu blocks missed the %.3f ms deadline; worst: %.3f ms; average load: %.1f%%",
+        misses,
+        blocks,
+        budget * 1e3,
+        worst * 1e3,
+        load() * 100.
+      );
+      return buffer;
+    }
+};
+
+/**
+ * Keeps the processing within the real-time budget by trading quality for speed, step by step.
+ * Watches the per-block load (processing time over the budget, from a DeadlineMonitor): a sustained load
+ * above high, or a single block that overran the budget, goes one step cheaper (then waits for the effect
+ * to show before going further), and a load below low for hold seconds goes one step back. What each step does is up to the caller;
+ * step 0 is the full quality. A step that had to be taken back right after recovering doubles the hold
+ * (up to maxHold), so the controller doesn't keep bouncing between two steps at the edge of the budget.
+ *
+ * @class OverloadController
+ * @par EXAMPLE
+ * auto monitor = DeadlineMonitor(256, 44100);
+ * auto controller = OverloadController(monitor.budget, 3);
+ * // for every block
+ * monitor.start();
+ * // ...process the block at the quality of controller.step...
+ * monitor.stop();
+ * if (controller.update(monitor.last))
+ *   std::cerr << "step " << controller.step << ": " << controller.reason << std::endl;
+ */
+class OverloadController {
+  private:
+    double budget;
+    double load = 0.;       // smoothed
+    double aboveFor = 0.;   // seconds of processed audio with the load over high
+    double belowFor = 0.;   // same, under low
+    double settleFor = 0.;  // seconds left before another step down is considered
+    double sinceRecovery = -1.; // seconds since the last step back up (negative when it wasn't the last change)
+    double holdFactor = 1.;
+
+  public:
+    unsigned step = 0;
+    unsigned steps;         // number of steps down available
+    double high = .9;       // fraction of the budget that triggers a step down...
+    double react = .05;     // ...when sustained for that many seconds
+    double low = .5;        // fraction of the budget under which a step back up is taken...
+    double hold = 2.;       // ...when sustained for that many seconds
+    double maxHold = 60.;
+    double smoothing = .2;  // weight of the newest block in the smoothed load
+    unsigned long changes = 0;
+    std::string reason;     // why the last change happened
+
+    /**
+     * Creates an instance of OverloadController.
+     * @param budget_ Seconds per block (DeadlineMonitor::budget).
+     * @param steps_ Number of steps down available.
+     * @memberof OverloadController
+     */
+    OverloadController(const double budget_, const unsigned steps_)
+      : budget(budget_), steps(steps_)
+    {}
+
+    /**
+     * Accounts for a processed block.
+     *
+     * @param elapsed Processing time of the block, in seconds (DeadlineMonitor::last).
+     * @return true when the step changed; see step & reason.
+     * @memberof OverloadController
+     */
+    bool update(const double elapsed) {
+      load += smoothing * (elapsed / budget - load);
+      settleFor -= budget;
+      if (sinceRecovery >= 0.)
+        sinceRecovery += budget;
+      aboveFor = load > high ? aboveFor + budget : 0.;
+      belowFor = load < low ? belowFor + budget : 0.;
+
+      // a missed deadline is a glitch already; the smoothed load would take several more to get over high
+      const bool overrun = elapsed > budget;
+
+      char buffer[128];
+      if ((aboveFor >= react || overrun) && settleFor <= 0. && step < steps) {
+        // stepping down right after a recovery means the recovery was premature
+        if (sinceRecovery >= 0. && sinceRecovery < requiredHold())
+          holdFactor = std::min(2. * holdFactor, maxHold / hold);
+        if (aboveFor >= react)
+          snprintf(buffer, sizeof(buffer), "load %.0f%% over %.0f%% of the %.3f ms budget", load * 100., high * 100., budget * 1e3);
+        else
+          snprintf(buffer, sizeof(buffer), "block took %.3f ms of the %.3f ms budget", elapsed * 1e3, budget * 1e3);
+        step++;
+        // the smoothed load needs a few blocks to reflect the cheaper step
+        settleFor = std::max(react, 5. / smoothing * budget);
+        sinceRecovery = -1.;
+      } else if (belowFor >= requiredHold() && step > 0) {
+        snprintf(buffer, sizeof(buffer), "load %.0f%% under %.0f%% for %.1f s", load * 100., low * 100., belowFor);
+        step--;
+        sinceRecovery = 0.;
+      } else {
+        // a long stable stretch forgives the past bouncing
+        if (sinceRecovery > maxHold) {
+          holdFactor = 1.;
+          sinceRecovery = -1.;
+        }
+        return false;
+      }
+
+      aboveFor = belowFor = 0.;
+      reason = buffer;
+      changes++;
+      return true;
+    }
+
+    /**
+     * The smoothed load, as a fraction of the budget.
+     *
+     * @memberof OverloadController
+     */
+    double smoothedLoad() const {
+      return load;
+    }
+
+    /**
+     * Seconds of low load currently required before stepping back up.
+     *
+     * @memberof OverloadController
+     */
+    double requiredHold() const {
+      return std::min(hold * holdFactor, maxHold);
+    }
+};
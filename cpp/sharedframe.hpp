@@ -0,0 +1,297 @@
+/**
+ * @file sharedframe.hpp
+ * @brief Publishes the most recent levels frame to local display processes (Linux-specific; uses POSIX shared memory).
+ * @see http://github.com/creaktive/pianolizer
+ * @author Stanislaw Pusep
+ * @copyright MIT
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "shared memory needs lock-free atomics");
+
+/**
+ * Layout of the shared memory object & the mapping common to both ends.
+ * The object holds one frame only: the header, then the frame counter, its timestamp & the levels,
+ * all guarded by a seqlock (the sequence is odd while the writer is updating them).
+ * The offsets are fixed, so that the readers in other languages (misc/sharedframe.py) just unpack them.
+ *
+ * @class SharedFrame
+ */
+class SharedFrame {
+  protected:
+    struct Header {
+      char magic[8];
+      uint32_t version;
+      uint32_t keys;
+      uint32_t sampleRate;
+      uint32_t blockSize;
+      int32_t pid;
+      std::atomic<uint32_t> closed;
+      std::atomic<uint64_t> sequence;
+      // the payload: frames published since the start, CLOCK_MONOTONIC of the publication (ns) & keys floats
+      std::atomic<uint64_t> frame;
+      std::atomic<int64_t> timestamp;
+    };
+    static_assert(sizeof(Header) == 56, "the readers in other languages rely on this layout");
+
+    static constexpr uint32_t version = 1;
+    static const char *magic() { return "PNLZFRAM"; }
+
+    std::string name;
+    int fd = -1;
+    size_t bytes = 0;
+    Header *header = nullptr;
+    float *values = nullptr;
+
+    static std::string shmName(const std::string& name_) {
+      return name_.front() == '/' ? name_ : "/" + name_;
+    }
+
+    void map(const int prot) {
+      void *base = mmap(nullptr, bytes, prot, MAP_SHARED, fd, 0);
+      if (base == MAP_FAILED)
+        throw std::runtime_error("mmap " + name + ": " + strerror(errno));
+      header = static_cast<Header*>(base);
+      values = reinterpret_cast<float*>(static_cast<char*>(base) + sizeof(Header));
+    }
+
+    static size_t size(const unsigned keys) {
+      const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+      return (sizeof(Header) + keys * sizeof(float) + page - 1) / page * page;
+    }
+
+    SharedFrame() = default;
+
+  public:
+    SharedFrame(const SharedFrame&) = delete;
+    SharedFrame& operator=(const SharedFrame&) = delete;
+
+    ~SharedFrame() {
+      if (header != nullptr)
+        munmap(header, bytes);
+      if (fd != -1)
+        close(fd);
+    }
+
+    /**
+     * Number of levels in a frame.
+     *
+     * @memberof SharedFrame
+     */
+    unsigned keys() const {
+      return header->keys;
+    }
+
+    /**
+     * Frames per second the writer publishes: sample rate / block size.
+     *
+     * @memberof SharedFrame
+     */
+    double frameRate() const {
+      return static_cast<double>(header->sampleRate) / header->blockSize;
+    }
+
+    /**
+     * CLOCK_MONOTONIC, in nanoseconds; the clock of the frame timestamps.
+     *
+     * @memberof SharedFrame
+     */
+    static int64_t now() {
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+};
+
+/**
+ * Analyzer side of the SharedFrame. Overwrites the frame in place, never waiting for anybody:
+ * the readers come & go at their own pace. Creating it replaces any previous object with the same name;
+ * destroying it marks the frame as closed & unlinks the object.
+ *
+ * @class SharedFrameWriter
+ * @par EXAMPLE
+ * SharedFrameWriter frame("pianolizer-leds", 61, 44100, 256);
+ * frame.publish(levels); // once per block
+ */
+class SharedFrameWriter : public SharedFrame {
+  public:
+    /**
+     * Creates the shared memory object with an empty frame.
+     *
+     * @param name_ Shared memory object name; the leading '/' is optional.
+     * @param keys_ Number of levels in a frame.
+     * @param sampleRate_ Sample rate of the analysis, passed on to the readers.
+     * @param blockSize_ Samples per frame, passed on to the readers.
+     * @memberof SharedFrameWriter
+     */
+    SharedFrameWriter(const std::string& name_, const unsigned keys_, const unsigned sampleRate_, const unsigned blockSize_) {
+      if (keys_ == 0 || blockSize_ == 0)
+        throw std::invalid_argument("empty frame");
+      name = shmName(name_);
+      bytes = size(keys_);
+
+      // a fresh object, so that the readers of a previous one are left alone
+      shm_unlink(name.c_str());
+      if ((fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644)) == -1)
+        throw std::runtime_error("shm_open " + name + ": " + strerror(errno));
+      if (ftruncate(fd, static_cast<off_t>(bytes)) == -1) {
+        const std::string error = strerror(errno);
+        shm_unlink(name.c_str());
+        throw std::runtime_error("ftruncate " + name + ": " + error);
+      }
+      try {
+        map(PROT_READ | PROT_WRITE);
+      } catch (...) {
+        shm_unlink(name.c_str());
+        throw;
+      }
+
+      new (header) Header();
+      header->version = version;
+      header->keys = keys_;
+      header->sampleRate = sampleRate_;
+      header->blockSize = blockSize_;
+      header->pid = getpid();
+      // the magic goes last: the readers validate it before trusting the rest
+      std::atomic_thread_fence(std::memory_order_release);
+      memcpy(header->magic, magic(), sizeof(header->magic));
+    }
+
+    ~SharedFrameWriter() {
+      if (header != nullptr)
+        header->closed.store(1, std::memory_order_release);
+      shm_unlink(name.c_str());
+    }
+
+    /**
+     * Replaces the frame.
+     *
+     * @param levels keys() floats.
+     * @param [timestamp=now()] CLOCK_MONOTONIC of the frame, in nanoseconds.
+     * @return The frame counter, starting at 1.
+     * @memberof SharedFrameWriter
+     */
+    uint64_t publish(const float *levels, const int64_t timestamp = now()) {
+      const uint64_t sequence = header->sequence.load(std::memory_order_relaxed);
+      const uint64_t frame = header->frame.load(std::memory_order_relaxed) + 1;
+      header->sequence.store(sequence + 1, std::memory_order_relaxed);
+      // the readers must see the odd sequence before any of the payload changes
+      std::atomic_thread_fence(std::memory_order_release);
+      header->frame.store(frame, std::memory_order_relaxed);
+      header->timestamp.store(timestamp, std::memory_order_relaxed);
+      memcpy(values, levels, header->keys * sizeof(float));
+      header->sequence.store(sequence + 2, std::memory_order_release);
+      return frame;
+    }
+};
+
+/**
+ * Display side of the SharedFrame: copies the newest frame out, lock-free, whenever the display is ready for it.
+ * The frame counter tells how many frames were skipped in between, & the timestamp how old the frame is.
+ *
+ * @class SharedFrameReader
+ * @par EXAMPLE
+ * SharedFrameReader frame("pianolizer-leds");
+ * std::vector<float> levels(frame.keys());
+ * uint64_t counter = 0;
+ * int64_t timestamp;
+ * while (!frame.closed()) {
+ *   if (frame.read(levels.data(), counter, timestamp))
+ *     ; // display the levels; SharedFrame::now() - timestamp is their age
+ *   usleep(1000000 / 60);
+ * }
+ */
+class SharedFrameReader : public SharedFrame {
+  public:
+    unsigned long retries = 0;
+    unsigned long stalls = 0;     // reads that gave up on an update that did not finish
+    unsigned maxRetries = 100000; // far longer than an update takes, unless the writer was preempted or died in it
+
+    /**
+     * Attaches to a published frame.
+     *
+     * @param name_ Shared memory object name, as given to the SharedFrameWriter.
+     * @memberof SharedFrameReader
+     */
+    SharedFrameReader(const std::string& name_) {
+      name = shmName(name_);
+      if ((fd = shm_open(name.c_str(), O_RDONLY, 0)) == -1)
+        throw std::runtime_error("shm_open " + name + ": " + strerror(errno));
+
+      struct stat status;
+      if (fstat(fd, &status) == -1 || static_cast<size_t>(status.st_size) < sizeof(Header))
+        throw std::runtime_error("not a ready shared frame: " + name);
+      bytes = static_cast<size_t>(status.st_size);
+      map(PROT_READ);
+
+      if (memcmp(header->magic, magic(), sizeof(header->magic)) != 0)
+        throw std::runtime_error("not a ready shared frame: " + name);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (header->version != version)
+        throw std::runtime_error("unsupported shared frame version: " + std::to_string(header->version));
+      if (header->keys == 0 || header->blockSize == 0 || size(header->keys) != bytes)
+        throw std::runtime_error("corrupt shared frame: " + name);
+    }
+
+    /**
+     * Copies the newest frame, retrying while the writer is in the middle of an update
+     * (that is, for a few hundred nanoseconds, usually). After maxRetries, gives up & counts a stall:
+     * a writer that died halfway through an update never finishes it; see closed().
+     *
+     * @param levels Where to copy keys() floats to.
+     * @param frame The counter of the frame read so far (0 for none); on return, the counter of the frame copied.
+     * @param timestamp On return, CLOCK_MONOTONIC of the frame copied, in nanoseconds.
+     * @return false when no frame newer than the given counter was published, or the update did not finish;
+     * the levels are left alone.
+     * @memberof SharedFrameReader
+     */
+    bool read(float *levels, uint64_t& frame, int64_t& timestamp) {
+      for (unsigned attempt = 0;; attempt++, retries++) {
+        if (attempt > maxRetries) {
+          stalls++;
+          return false;
+        }
+        const uint64_t before = header->sequence.load(std::memory_order_acquire);
+        if (before & 1)
+          continue;
+        const uint64_t counter = header->frame.load(std::memory_order_relaxed);
+        if (counter == frame)
+          return false;
+        const int64_t published = header->timestamp.load(std::memory_order_relaxed);
+        memcpy(levels, values, header->keys * sizeof(float));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header->sequence.load(std::memory_order_relaxed) != before)
+          continue;
+        frame = counter;
+        timestamp = published;
+        return true;
+      }
+    }
+
+    /**
+     * Tells whether the writer is gone: it closed the frame or died.
+     *
+     * @memberof SharedFrameReader
+     */
+    bool closed() const {
+      return header->closed.load(std::memory_order_acquire) != 0
+        || (kill(header->pid, 0) == -1 && errno == ESRCH);
+    }
+};
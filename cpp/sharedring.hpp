@@ -0,0 +1,427 @@
+/**
+ * @file sharedring.hpp
+ * @brief Shares one captured PCM stream with many local analyzer processes (Linux-specific; uses POSIX shared memory & futex).
+ * @see http://github.com/creaktive/pianolizer
+ * @author Stanislaw Pusep
+ * @copyright MIT
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "shared memory needs lock-free atomics");
+
+/**
+ * Layout of the shared memory object & the mapping common to both ends.
+ * The object is one page of header followed by the sample data (interleaved 32-bit floats).
+ * The data is mapped twice, back to back, so that any block of up to the capacity is contiguous
+ * in memory, even when it wraps around the end of the ring; hence the blocks are read in place.
+ *
+ * @class SharedRing
+ */
+class SharedRing {
+  protected:
+    struct Header {
+      char magic[8];
+      uint32_t version;
+      uint32_t channels;
+      uint32_t sampleRate;
+      int32_t pid;
+      uint64_t capacity; // in frames (one sample of every channel)
+      // frames the writer may be overwriting right now: [published, claimed)
+      alignas(64) std::atomic<uint64_t> claimed;
+      // frames completely written since the start; the sequence counter
+      std::atomic<uint64_t> published;
+      std::atomic<uint32_t> wake; // futex word, bumped on every publication
+      std::atomic<uint32_t> closed;
+    };
+
+    static constexpr uint32_t version = 1;
+    static const char *magic() { return "PNLZRING"; }
+
+    std::string name;
+    int fd = -1;
+    size_t headerBytes = 0;
+    size_t dataBytes = 0;
+    char *base = nullptr;
+    Header *header = nullptr;
+    float *data = nullptr;
+
+    static std::string shmName(const std::string& name_) {
+      return name_.front() == '/' ? name_ : "/" + name_;
+    }
+
+    void map(const int prot) {
+      // reserve the address range first, then overlay the object & its second view of the data
+      const size_t total = headerBytes + 2 * dataBytes;
+      void *reserved = mmap(nullptr, total, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (reserved == MAP_FAILED)
+        throw std::runtime_error(std::string("mmap: ") + strerror(errno));
+      base = static_cast<char*>(reserved);
+      if (mmap(base, headerBytes + dataBytes, prot, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+        || mmap(base + headerBytes + dataBytes, dataBytes, prot, MAP_SHARED | MAP_FIXED, fd, static_cast<off_t>(headerBytes)) == MAP_FAILED
+      ) {
+        const std::string error = strerror(errno);
+        munmap(base, total);
+        base = nullptr;
+        throw std::runtime_error("mmap " + name + ": " + error);
+      }
+      header = reinterpret_cast<Header*>(base);
+      data = reinterpret_cast<float*>(base + headerBytes);
+    }
+
+    static size_t pageSize() {
+      return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    SharedRing() = default;
+
+  public:
+    SharedRing(const SharedRing&) = delete;
+    SharedRing& operator=(const SharedRing&) = delete;
+
+    ~SharedRing() {
+      if (base != nullptr)
+        munmap(base, headerBytes + 2 * dataBytes);
+      if (fd != -1)
+        close(fd);
+    }
+
+    /**
+     * Number of interleaved channels.
+     *
+     * @memberof SharedRing
+     */
+    unsigned channels() const {
+      return header->channels;
+    }
+
+    /**
+     * Sample rate declared by the writer.
+     *
+     * @memberof SharedRing
+     */
+    unsigned sampleRate() const {
+      return header->sampleRate;
+    }
+
+    /**
+     * Size of the ring, in frames.
+     *
+     * @memberof SharedRing
+     */
+    size_t capacity() const {
+      return static_cast<size_t>(header->capacity);
+    }
+
+    /**
+     * Frames published since the writer started.
+     *
+     * @memberof SharedRing
+     */
+    uint64_t sequence() const {
+      return header->published.load(std::memory_order_acquire);
+    }
+};
+
+/**
+ * Capture side of the SharedRing. Never waits for the readers: it doesn't even know about them.
+ * Creating a ring replaces any previous one with the same name (the readers attached to the old one
+ * keep their mapping & see it closed); destroying it closes & unlinks the ring.
+ *
+ * @class SharedRingWriter
+ * @par EXAMPLE
+ * SharedRingWriter ring("pianolizer", 1, 44100);
+ * float *block = ring.claim(256);
+ * // fill the block with 256 frames, e.g. with fread()
+ * ring.publish(256);
+ */
+class SharedRingWriter : public SharedRing {
+  private:
+    size_t claimedFrames = 0;
+
+  public:
+    /**
+     * Creates the shared memory object & announces the stream.
+     *
+     * @param name_ Shared memory object name; the leading '/' is optional.
+     * @param channels_ Number of interleaved channels.
+     * @param sampleRate_ Sample rate, passed on to the readers.
+     * @param [capacity_=0] Minimum ring size, in frames; 0 means 2 seconds. Rounded up to whole pages.
+     * @memberof SharedRingWriter
+     */
+    SharedRingWriter(const std::string& name_, const unsigned channels_, const unsigned sampleRate_, size_t capacity_ = 0) {
+      if (channels_ == 0)
+        throw std::invalid_argument("no channels");
+      name = shmName(name_);
+      if (capacity_ == 0)
+        capacity_ = 2 * sampleRate_;
+      // the second view of the data has to start on a page boundary
+      const size_t frameBytes = channels_ * sizeof(float);
+      const size_t page = pageSize();
+      size_t granule = page;
+      while (granule % frameBytes)
+        granule += page;
+      headerBytes = page;
+      dataBytes = (capacity_ * frameBytes + granule - 1) / granule * granule;
+
+      // a fresh object, so that the readers of a previous one are left alone
+      shm_unlink(name.c_str());
+      if ((fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644)) == -1)
+        throw std::runtime_error("shm_open " + name + ": " + strerror(errno));
+      if (ftruncate(fd, static_cast<off_t>(headerBytes + dataBytes)) == -1) {
+        const std::string error = strerror(errno);
+        shm_unlink(name.c_str());
+        throw std::runtime_error("ftruncate " + name + ": " + error);
+      }
+      try {
+        map(PROT_READ | PROT_WRITE);
+      } catch (...) {
+        shm_unlink(name.c_str());
+        throw;
+      }
+
+      new (header) Header();
+      header->version = version;
+      header->channels = channels_;
+      header->sampleRate = sampleRate_;
+      header->pid = getpid();
+      header->capacity = dataBytes / frameBytes;
+      // the magic goes last: the readers validate it before trusting the rest
+      std::atomic_thread_fence(std::memory_order_release);
+      memcpy(header->magic, magic(), sizeof(header->magic));
+    }
+
+    ~SharedRingWriter() {
+      if (header != nullptr)
+        close();
+      shm_unlink(name.c_str());
+    }
+
+    /**
+     * Returns the place for the next block, to be filled in & then published.
+     * The readers that lag behind by the whole ring lose the oldest frames from this moment on.
+     *
+     * @param frames Block size, up to the capacity.
+     * @return Pointer to frames * channels contiguous floats.
+     * @memberof SharedRingWriter
+     */
+    float *claim(const size_t frames) {
+      if (frames > capacity())
+        throw std::invalid_argument("block larger than the ring");
+      const uint64_t head = header->published.load(std::memory_order_relaxed);
+      claimedFrames = frames;
+      header->claimed.store(head + frames, std::memory_order_relaxed);
+      // the readers must see the claim before any of the data it overwrites changes
+      std::atomic_thread_fence(std::memory_order_release);
+      return data + (head % header->capacity) * header->channels;
+    }
+
+    /**
+     * Makes the claimed block visible to the readers & wakes them up.
+     *
+     * @param frames How much of the claimed block was actually filled.
+     * @memberof SharedRingWriter
+     */
+    void publish(size_t frames) {
+      if (frames > claimedFrames)
+        frames = claimedFrames;
+      const uint64_t head = header->published.load(std::memory_order_relaxed) + frames;
+      header->published.store(head, std::memory_order_release);
+      header->claimed.store(head, std::memory_order_relaxed);
+      claimedFrames = 0;
+      header->wake.fetch_add(1, std::memory_order_release);
+      syscall(SYS_futex, &header->wake, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+    /**
+     * Copies a block of interleaved frames into the ring.
+     *
+     * @param samples Interleaved samples.
+     * @param frames Number of frames.
+     * @memberof SharedRingWriter
+     */
+    void write(const float *samples, const size_t frames) {
+      memcpy(claim(frames), samples, frames * header->channels * sizeof(float));
+      publish(frames);
+    }
+
+    /**
+     * Tells the readers that the stream ended.
+     *
+     * @memberof SharedRingWriter
+     */
+    void close() {
+      header->closed.store(1, std::memory_order_release);
+      header->wake.fetch_add(1, std::memory_order_release);
+      syscall(SYS_futex, &header->wake, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+};
+
+/**
+ * Analyzer side of the SharedRing. The readers are independent from each other & from the writer,
+ * with the read-only mapping & their own position. A reader that falls more than half of the ring behind
+ * skips forward to the most recent block, counting the skipped frames in dropped. The block returned by acquire()
+ * is the ring memory itself, so release() tells whether the writer overwrote it while it was being used
+ * (counted in torn; only happens when the reader stalls for a good part of the ring duration).
+ *
+ * @class SharedRingReader
+ * @par EXAMPLE
+ * SharedRingReader ring("pianolizer");
+ * size_t frames = 256;
+ * const float *block;
+ * while ((block = ring.acquire(frames)) != nullptr) {
+ *   // use frames * ring.channels() samples
+ *   if (!ring.release())
+ *     ; // the block was overwritten while in use
+ * }
+ */
+class SharedRingReader : public SharedRing {
+  private:
+    uint64_t position = 0;
+    uint64_t blockStart = 0;
+    bool orphaned = false;
+
+    // the writer may have crashed without closing the stream
+    bool writerGone() {
+      if (!orphaned)
+        orphaned = kill(header->pid, 0) == -1 && errno == ESRCH;
+      return orphaned;
+    }
+
+  public:
+    unsigned long dropped = 0;
+    unsigned long torn = 0;
+
+    /**
+     * Attaches to a ring; starts at its current end, so only the frames published from now on get read.
+     *
+     * @param name_ Shared memory object name, as given to the SharedRingWriter.
+     * @memberof SharedRingReader
+     */
+    SharedRingReader(const std::string& name_) {
+      name = shmName(name_);
+      if ((fd = shm_open(name.c_str(), O_RDONLY, 0)) == -1)
+        throw std::runtime_error("shm_open " + name + ": " + strerror(errno));
+
+      struct stat status;
+      headerBytes = pageSize();
+      if (fstat(fd, &status) == -1 || static_cast<size_t>(status.st_size) <= headerBytes)
+        throw std::runtime_error("not a ready shared ring: " + name);
+      dataBytes = static_cast<size_t>(status.st_size) - headerBytes;
+      map(PROT_READ);
+
+      if (memcmp(header->magic, magic(), sizeof(header->magic)) != 0)
+        throw std::runtime_error("not a ready shared ring: " + name);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (header->version != version)
+        throw std::runtime_error("unsupported shared ring version: " + std::to_string(header->version));
+      if (header->channels == 0 || header->capacity * header->channels * sizeof(float) != dataBytes)
+        throw std::runtime_error("corrupt shared ring: " + name);
+      position = sequence();
+    }
+
+    /**
+     * Waits for the next block, without copying it.
+     *
+     * @param frames Wanted frames, up to half of the capacity; on return, the frames actually available
+     * (fewer only at the end of the stream).
+     * @param [timeout=-1] Milliseconds to wait; -1 waits until the block arrives or the stream ends.
+     * @return Pointer to frames * channels() interleaved floats; nullptr at the end of the stream, on timeout
+     * or when interrupted by a signal (check ended()).
+     * @memberof SharedRingReader
+     */
+    const float *acquire(size_t& frames, const int timeout = -1) {
+      if (frames > capacity() / 2)
+        throw std::invalid_argument("block larger than half of the ring");
+      const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+      for (;;) {
+        const uint32_t wake = header->wake.load(std::memory_order_acquire);
+        const uint64_t head = sequence();
+        if (head - position > capacity() / 2) {
+          // fell behind: resume with the most recent block
+          const uint64_t resume = head - frames;
+          dropped += static_cast<unsigned long>(resume - position);
+          position = resume;
+        }
+
+        const bool closed = header->closed.load(std::memory_order_acquire) != 0 || orphaned;
+        if (head - position >= frames || (closed && head > position)) {
+          if (head - position < frames)
+            frames = static_cast<size_t>(head - position);
+          blockStart = position;
+          position += frames;
+          return data + (blockStart % header->capacity) * header->channels;
+        }
+        if (closed) {
+          frames = 0;
+          return nullptr;
+        }
+
+        // sleep until the next publication; re-checking the writer every second, in case it crashed
+        long wait = 1000;
+        if (timeout >= 0) {
+          wait = std::min(wait, static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()
+          ).count()));
+          if (wait <= 0) {
+            frames = 0;
+            return nullptr;
+          }
+        }
+        const timespec interval = { wait / 1000, (wait % 1000) * 1000000 };
+        if (syscall(SYS_futex, &header->wake, FUTEX_WAIT, wake, &interval, nullptr, 0) == -1) {
+          if (errno == EINTR) {
+            frames = 0;
+            return nullptr;
+          }
+          if (errno == ETIMEDOUT && wait == 1000)
+            writerGone();
+        }
+      }
+    }
+
+    /**
+     * Checks that the last acquired block was not overwritten while in use.
+     *
+     * @return false if the block was (partially) overwritten; it should be discarded.
+     * @memberof SharedRingReader
+     */
+    bool release() {
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (header->claimed.load(std::memory_order_relaxed) <= blockStart + header->capacity)
+        return true;
+      torn++;
+      return false;
+    }
+
+    /**
+     * Tells whether the stream ended: the writer closed it or died.
+     *
+     * @memberof SharedRingReader
+     */
+    bool ended() {
+      return (header->closed.load(std::memory_order_acquire) != 0 || writerGone())
+        && sequence() <= position;
+    }
+};
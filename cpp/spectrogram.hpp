@@ -0,0 +1,461 @@
+/**
+ * @file spectrogram.hpp
+ * @brief Compact, seekable on-disk archive of the quantized levels (POSIX-specific; the reader uses mmap).
+ * @see http://github.com/creaktive/pianolizer
+ * @author Stanislaw Pusep
+ * @copyright MIT
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pianolizer.hpp"
+
+/**
+ * Layout of the archive (all the integers are little-endian):
+ *
+ * header:   "PNLZSPEC", u32 version, u32 sampleRate, u32 bands, u32 hopSize, u32 framesPerChunk,
+ *           u32 scale (OutputTransform::Scale), u32 referenceKey, f64 pitchFork, f64 tolerance,
+ *           u64 frames, u64 indexOffset, then bands * (u32 k, u32 N)
+ * chunks:   u32 frames, u32 payload size, payload
+ * index:    u32 chunks, then chunks * u64 offset
+ *
+ * The payload of a chunk is the first frame followed by the differences (modulo 256) of each frame
+ * from the previous one; since the levels change slowly, that is mostly zeros, which get run-length encoded
+ * (0x00 followed by the run length minus 1). Every chunk decodes on its own.
+ * The frames & indexOffset fields are only filled in by close(); without them, the reader scans the chunks.
+ *
+ * @class SpectrogramFormat
+ */
+class SpectrogramFormat {
+  public:
+    static const char* magic() {
+      return "PNLZSPEC";
+    }
+
+    static constexpr uint32_t version = 1;
+    static constexpr size_t headerSize = 8 + 7 * 4 + 2 * 8 + 2 * 8;
+    static constexpr size_t framesOffset = headerSize - 2 * 8;
+    static constexpr size_t chunkHeaderSize = 2 * 4;
+
+    static void putU32(std::vector<uint8_t>& output, const uint32_t value) {
+      for (unsigned i = 0; i < 4; i++)
+        output.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+
+    static void putU64(std::vector<uint8_t>& output, const uint64_t value) {
+      for (unsigned i = 0; i < 8; i++)
+        output.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+
+    static void putF64(std::vector<uint8_t>& output, const double value) {
+      uint64_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      putU64(output, bits);
+    }
+
+    static uint32_t getU32(const uint8_t *input) {
+      uint32_t value = 0;
+      for (unsigned i = 0; i < 4; i++)
+        value |= static_cast<uint32_t>(input[i]) << (8 * i);
+      return value;
+    }
+
+    static uint64_t getU64(const uint8_t *input) {
+      uint64_t value = 0;
+      for (unsigned i = 0; i < 8; i++)
+        value |= static_cast<uint64_t>(input[i]) << (8 * i);
+      return value;
+    }
+
+    static double getF64(const uint8_t *input) {
+      const uint64_t bits = getU64(input);
+      double value;
+      memcpy(&value, &bits, sizeof(value));
+      return value;
+    }
+};
+
+/**
+ * Appends the frames (as quantized by OutputTransform) to an archive file.
+ *
+ * @class SpectrogramWriter
+ * @par EXAMPLE
+ * auto tuning = std::make_shared<PianoTuning>(44100);
+ * SpectrogramWriter writer("session.pnlz", tuning, 256);
+ * // for every processed block
+ * transform.apply(slidingDFT.process(input, 256, 0.04), values);
+ * writer.write(values);
+ * // writes the index; also done by the destructor
+ * writer.close();
+ */
+class SpectrogramWriter {
+  private:
+    FILE *file = nullptr;
+    std::vector<uint8_t> frames;    // the pending chunk, raw
+    std::vector<uint8_t> encoded;
+    std::vector<uint64_t> index;
+    uint64_t offset = 0;
+    unsigned pending = 0;
+
+    void put(const std::vector<uint8_t>& data) {
+      if (fwrite(data.data(), 1, data.size(), file) != data.size())
+        throw std::runtime_error(std::string("fwrite: ") + strerror(errno));
+      offset += data.size();
+    }
+
+    uint8_t previous(const size_t i) const {
+      return i >= bands ? frames[i - bands] : 0;
+    }
+
+    void flushChunk() {
+      if (pending == 0)
+        return;
+
+      encoded.clear();
+      SpectrogramFormat::putU32(encoded, pending);
+      SpectrogramFormat::putU32(encoded, 0); // payload size, patched below
+
+      const size_t length = static_cast<size_t>(pending) * bands;
+      for (size_t i = 0; i < length; ) {
+        const uint8_t delta = static_cast<uint8_t>(frames[i] - previous(i));
+        if (delta != 0) {
+          encoded.push_back(delta);
+          i++;
+          continue;
+        }
+        unsigned run = 1;
+        while (run < 256 && i + run < length && frames[i + run] == previous(i + run))
+          run++;
+        encoded.push_back(0);
+        encoded.push_back(static_cast<uint8_t>(run - 1));
+        i += run;
+      }
+
+      const uint32_t payload = static_cast<uint32_t>(encoded.size() - SpectrogramFormat::chunkHeaderSize);
+      for (unsigned i = 0; i < 4; i++)
+        encoded[4 + i] = static_cast<uint8_t>(payload >> (8 * i));
+
+      index.push_back(offset);
+      put(encoded);
+      pending = 0;
+    }
+
+  public:
+    unsigned bands, hopSize, framesPerChunk;
+    uint64_t frameCount = 0;
+
+    /**
+     * Creates (truncates) the archive & writes the header.
+     * @param path File name.
+     * @param tuning Tuning the levels come from; the k & N of each band are stored, and so are the PianoTuning parameters.
+     * @param hopSize_ Samples per frame.
+     * @param [scale=OutputTransform::LINEAR] Scale of the quantized values, for the reference of the reader.
+     * @param [framesPerChunk_=256] Granularity of the seeking; larger chunks compress slightly better.
+     * @memberof SpectrogramWriter
+     */
+    SpectrogramWriter(
+      const std::string& path,
+      const std::shared_ptr<Tuning> tuning,
+      const unsigned hopSize_,
+      const OutputTransform::Scale scale = OutputTransform::LINEAR,
+      const unsigned framesPerChunk_ = 256
+    ) : bands(tuning->bands), hopSize(hopSize_), framesPerChunk(framesPerChunk_) {
+      if (bands == 0 || hopSize == 0 || framesPerChunk == 0)
+        throw std::invalid_argument("bands, hop size & frames per chunk must be positive");
+      if ((file = fopen(path.c_str(), "wb")) == nullptr)
+        throw std::runtime_error("fopen " + path + ": " + strerror(errno));
+
+      auto piano = std::dynamic_pointer_cast<PianoTuning>(tuning);
+      std::vector<uint8_t> header(SpectrogramFormat::magic(), SpectrogramFormat::magic() + 8);
+      SpectrogramFormat::putU32(header, SpectrogramFormat::version);
+      SpectrogramFormat::putU32(header, tuning->sampleRate);
+      SpectrogramFormat::putU32(header, bands);
+      SpectrogramFormat::putU32(header, hopSize);
+      SpectrogramFormat::putU32(header, framesPerChunk);
+      SpectrogramFormat::putU32(header, scale);
+      SpectrogramFormat::putU32(header, piano != nullptr ? piano->referenceKey() : 0);
+      SpectrogramFormat::putF64(header, piano != nullptr ? piano->pitchFork() : 0.);
+      SpectrogramFormat::putF64(header, piano != nullptr ? piano->tolerance() : 0.);
+      SpectrogramFormat::putU64(header, 0);
+      SpectrogramFormat::putU64(header, 0);
+      for (auto band : tuning->mapping()) {
+        SpectrogramFormat::putU32(header, band.k);
+        SpectrogramFormat::putU32(header, band.N);
+      }
+      put(header);
+
+      frames.resize(static_cast<size_t>(framesPerChunk) * bands);
+    }
+
+    SpectrogramWriter(const SpectrogramWriter&) = delete;
+    SpectrogramWriter& operator=(const SpectrogramWriter&) = delete;
+
+    ~SpectrogramWriter() {
+      try {
+        close();
+      } catch (...) {
+        // nothing sensible to do here; the reader recovers the archive without the index
+      }
+    }
+
+    /**
+     * Appends one frame.
+     *
+     * @param values The bands quantized to 8 bits (see OutputTransform::apply()).
+     * @memberof SpectrogramWriter
+     */
+    void write(const uint8_t values[]) {
+      if (file == nullptr)
+        throw std::logic_error("SpectrogramWriter is closed");
+      memcpy(frames.data() + static_cast<size_t>(pending) * bands, values, bands);
+      frameCount++;
+      if (++pending == framesPerChunk)
+        flushChunk();
+    }
+
+    /**
+     * Writes the pending frames, the index & the final header fields; the archive is complete afterwards.
+     *
+     * @memberof SpectrogramWriter
+     */
+    void close() {
+      if (file == nullptr)
+        return;
+
+      flushChunk();
+      const uint64_t indexOffset = offset;
+      std::vector<uint8_t> trailer;
+      SpectrogramFormat::putU32(trailer, static_cast<uint32_t>(index.size()));
+      for (auto chunkOffset : index)
+        SpectrogramFormat::putU64(trailer, chunkOffset);
+      put(trailer);
+
+      std::vector<uint8_t> fields;
+      SpectrogramFormat::putU64(fields, frameCount);
+      SpectrogramFormat::putU64(fields, indexOffset);
+      const bool patched = fseek(file, static_cast<long>(SpectrogramFormat::framesOffset), SEEK_SET) == 0
+        && fwrite(fields.data(), 1, fields.size(), file) == fields.size();
+      const bool closed = fclose(file) == 0;
+      file = nullptr;
+      if (!patched || !closed)
+        throw std::runtime_error(std::string("finalizing the archive: ") + strerror(errno));
+    }
+};
+
+/**
+ * Memory-maps an archive & decodes any range of frames & bands, touching only the chunks that cover it.
+ *
+ * @class SpectrogramReader
+ * @par EXAMPLE
+ * SpectrogramReader reader("session.pnlz");
+ * // keys 24 to 35 (C4 to B4), from 1:00 to 1:10
+ * const uint64_t first = reader.frameAt(60.);
+ * const uint64_t count = reader.frameAt(70.) - first;
+ * std::vector<uint8_t> values(count * 12);
+ * reader.read(first, count, 24, 12, values.data());
+ */
+class SpectrogramReader {
+  private:
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    std::vector<uint64_t> index;
+    std::vector<uint8_t> scratch;
+    uint64_t cachedChunk = ~static_cast<uint64_t>(0);
+
+    const uint8_t* at(const uint64_t position, const uint64_t length) const {
+      if (position > size || length > size - position)
+        throw std::runtime_error("truncated spectrogram archive");
+      return data + position;
+    }
+
+    // scans the chunks when the archive was not closed properly
+    void rebuildIndex(uint64_t position) {
+      frames = 0;
+      while (position + SpectrogramFormat::chunkHeaderSize <= size) {
+        const uint32_t chunkFrames = SpectrogramFormat::getU32(data + position);
+        const uint32_t payload = SpectrogramFormat::getU32(data + position + 4);
+        if (chunkFrames == 0 || chunkFrames > framesPerChunk
+          || position + SpectrogramFormat::chunkHeaderSize + payload > size)
+          break;
+        index.push_back(position);
+        frames += chunkFrames;
+        position += SpectrogramFormat::chunkHeaderSize + payload;
+      }
+    }
+
+    const uint8_t* decodeChunk(const uint64_t chunk) {
+      if (chunk == cachedChunk)
+        return scratch.data();
+
+      const uint8_t *header = at(index[chunk], SpectrogramFormat::chunkHeaderSize);
+      const size_t length = static_cast<size_t>(SpectrogramFormat::getU32(header)) * bands;
+      const uint32_t payload = SpectrogramFormat::getU32(header + 4);
+      const uint8_t *input = at(index[chunk] + SpectrogramFormat::chunkHeaderSize, payload);
+      if (length > scratch.size())
+        throw std::runtime_error("corrupt spectrogram chunk");
+
+      uint8_t *output = scratch.data();
+      size_t i = 0;
+      for (uint32_t j = 0; j < payload && i < length; j++) {
+        if (input[j] != 0) {
+          output[i] = static_cast<uint8_t>(input[j] + (i >= bands ? output[i - bands] : 0));
+          i++;
+          continue;
+        }
+        if (++j == payload)
+          break;
+        const size_t run = std::min(static_cast<size_t>(input[j]) + 1, length - i);
+        for (size_t r = 0; r < run; r++, i++)
+          output[i] = i >= bands ? output[i - bands] : 0;
+      }
+      if (i != length)
+        throw std::runtime_error("corrupt spectrogram chunk");
+
+      cachedChunk = chunk;
+      return output;
+    }
+
+  public:
+    unsigned version, sampleRate, bands, hopSize, framesPerChunk, referenceKey;
+    OutputTransform::Scale scale;
+    double pitchFork, tolerance;
+    uint64_t frames;
+    std::vector<Tuning::tuningValues> mapping;
+
+    /**
+     * Opens & maps the archive.
+     * @param path File name.
+     * @memberof SpectrogramReader
+     */
+    SpectrogramReader(const std::string& path) {
+      const int fd = open(path.c_str(), O_RDONLY);
+      if (fd == -1)
+        throw std::runtime_error("open " + path + ": " + strerror(errno));
+      struct stat st;
+      if (fstat(fd, &st) == -1 || st.st_size < static_cast<off_t>(SpectrogramFormat::headerSize)) {
+        ::close(fd);
+        throw std::runtime_error("not a spectrogram archive: " + path);
+      }
+      size = static_cast<size_t>(st.st_size);
+      void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if (mapped == MAP_FAILED)
+        throw std::runtime_error("mmap " + path + ": " + strerror(errno));
+      data = static_cast<const uint8_t*>(mapped);
+
+      if (memcmp(data, SpectrogramFormat::magic(), 8) != 0) {
+        munmap(const_cast<uint8_t*>(data), size);
+        throw std::runtime_error("not a spectrogram archive: " + path);
+      }
+      const uint8_t *field = data + 8;
+      version = SpectrogramFormat::getU32(field);
+      sampleRate = SpectrogramFormat::getU32(field + 4);
+      bands = SpectrogramFormat::getU32(field + 8);
+      hopSize = SpectrogramFormat::getU32(field + 12);
+      framesPerChunk = SpectrogramFormat::getU32(field + 16);
+      scale = static_cast<OutputTransform::Scale>(SpectrogramFormat::getU32(field + 20));
+      referenceKey = SpectrogramFormat::getU32(field + 24);
+      pitchFork = SpectrogramFormat::getF64(field + 28);
+      tolerance = SpectrogramFormat::getF64(field + 36);
+      frames = SpectrogramFormat::getU64(field + 44);
+      const uint64_t indexOffset = SpectrogramFormat::getU64(field + 52);
+      if (version != SpectrogramFormat::version || bands == 0 || framesPerChunk == 0) {
+        munmap(const_cast<uint8_t*>(data), size);
+        throw std::runtime_error("unsupported spectrogram archive: " + path);
+      }
+
+      try {
+        const uint8_t *table = at(SpectrogramFormat::headerSize, 8 * static_cast<uint64_t>(bands));
+        for (unsigned band = 0; band < bands; band++)
+          mapping.push_back({ SpectrogramFormat::getU32(table + 8 * band), SpectrogramFormat::getU32(table + 8 * band + 4) });
+        const uint64_t firstChunk = SpectrogramFormat::headerSize + 8 * static_cast<uint64_t>(bands);
+
+        if (indexOffset == 0) {
+          rebuildIndex(firstChunk);
+        } else {
+          const uint32_t chunks = SpectrogramFormat::getU32(at(indexOffset, 4));
+          const uint8_t *offsets = at(indexOffset + 4, 8 * static_cast<uint64_t>(chunks));
+          for (uint32_t chunk = 0; chunk < chunks; chunk++)
+            index.push_back(SpectrogramFormat::getU64(offsets + 8 * chunk));
+        }
+      } catch (...) {
+        munmap(const_cast<uint8_t*>(data), size);
+        throw;
+      }
+
+      scratch.resize(static_cast<size_t>(framesPerChunk) * bands);
+    }
+
+    SpectrogramReader(const SpectrogramReader&) = delete;
+    SpectrogramReader& operator=(const SpectrogramReader&) = delete;
+
+    ~SpectrogramReader() {
+      munmap(const_cast<uint8_t*>(data), size);
+    }
+
+    /**
+     * Frame that covers the moment.
+     *
+     * @param seconds Time since the start of the recording.
+     * @memberof SpectrogramReader
+     */
+    uint64_t frameAt(const double seconds) const {
+      if (seconds <= 0.)
+        return 0;
+      return std::min(frames, static_cast<uint64_t>(seconds * sampleRate / hopSize));
+    }
+
+    /**
+     * Decodes a range of frames & bands.
+     *
+     * @param firstFrame Index of the first frame.
+     * @param frameCount How many frames; clipped at the end of the archive.
+     * @param firstBand Index of the first band.
+     * @param bandCount How many bands.
+     * @param output frameCount * bandCount values, row-major.
+     * @return Number of frames decoded.
+     * @memberof SpectrogramReader
+     */
+    uint64_t read(
+      const uint64_t firstFrame,
+      uint64_t frameCount,
+      const unsigned firstBand,
+      const unsigned bandCount,
+      uint8_t output[]
+    ) {
+      if (firstBand > bands || bandCount > bands - firstBand)
+        throw std::out_of_range("band range exceeds the archive");
+      if (firstFrame >= frames)
+        return 0;
+      frameCount = std::min(frameCount, frames - firstFrame);
+
+      for (uint64_t frame = firstFrame; frame < firstFrame + frameCount; ) {
+        const uint64_t chunk = frame / framesPerChunk;
+        if (chunk >= index.size())
+          throw std::runtime_error("truncated spectrogram archive");
+        const uint8_t *decoded = decodeChunk(chunk);
+        const uint64_t end = std::min(firstFrame + frameCount, (chunk + 1) * framesPerChunk);
+        for (; frame < end; frame++)
+          memcpy(
+            output + (frame - firstFrame) * bandCount,
+            decoded + (frame - chunk * framesPerChunk) * bands + firstBand,
+            bandCount
+          );
+      }
+      return frameCount;
+    }
+};
@@ -1,10 +1,21 @@
 #include <chrono>
 #include <iostream>
 #include <map>
+#include <thread>
 #include <stdlib.h>
+#include <sys/wait.h>
 
 #include <gtest/gtest.h>
+#include "batch.hpp"
+#include "capture.hpp"
+#include "fanout.hpp"
+#include "realtime.hpp"
+#include "sharedframe.hpp"
+#include "sharedring.hpp"
+#include "libpianolizer.h"
 #include "pianolizer.hpp"
+#include "pianolizer-static.hpp"
+#include "spectrogram.hpp"
 
 using namespace std;
 
@@ -44,6 +55,56 @@ TEST(RingBuffer, Tiny) {
   EXPECT_EQ(rb.read(17), 18) << "wrap back to 1";
 }
 
+TEST(CompactRingBuffer, ExactSize) {
+  auto rb = CompactRingBuffer(10);
+  EXPECT_EQ(rb.size, static_cast<unsigned>(10)) << "not rounded up";
+
+  for (unsigned i = 0; i < 25; i++)
+    rb.write(i / 32.);
+  EXPECT_NEAR(rb.read(0), 24 / 32., 1e-4) << "head";
+  EXPECT_NEAR(rb.read(9), 15 / 32., 1e-4) << "tail";
+  EXPECT_NEAR(rb.read(10), 24 / 32., 1e-4) << "wraps at the exact size";
+
+  float chunk[10];
+  rb.readChunk(9, 10, chunk);
+  for (unsigned j = 0; j < 10; j++)
+    EXPECT_EQ(chunk[j], rb.read(9 - j)) << "chunk #" << j;
+
+  rb.write(3.);
+  EXPECT_NEAR(rb.read(0), 1., 1e-4) << "clipped to the full scale";
+}
+
+TEST(OutputTransform, GateClampQuantize) {
+  const float levels[] = { 0., .01, .25, .5, 1., 1.5, -.1, .04 };
+  auto transform = OutputTransform(8, OutputTransform::SQUARE_ROOT, .15);
+  transform.gain[7] = 4.;
+  transform.threshold[1] = 0.;
+
+  uint8_t output8[8];
+  transform.apply(levels, output8);
+  const uint8_t expected8[] = { 0, 26, 128, 180, 255, 255, 0, 204 };
+  for (unsigned i = 0; i < 8; i++)
+    EXPECT_EQ(output8[i], expected8[i]) << "uint8 #" << i;
+
+  uint16_t output16[8];
+  transform.apply(levels, output16);
+  EXPECT_EQ(output16[2], 32768) << "uint16";
+  EXPECT_EQ(output16[4], 65535) << "uint16 full scale";
+
+  float outputFloat[8];
+  transform.scale = OutputTransform::DECIBELS;
+  transform.threshold.assign(8, 0.);
+  transform.gain.assign(8, 1.);
+  transform.apply(levels, outputFloat);
+  EXPECT_NEAR(outputFloat[0], 0., ABS_ERROR) << "silence";
+  EXPECT_NEAR(outputFloat[1], 1. - 20. / 60., ABS_ERROR) << "-20dB";
+  EXPECT_NEAR(outputFloat[3], 1. + 10. * std::log10(.5) / 60., ABS_ERROR) << "-3dB";
+  EXPECT_NEAR(outputFloat[5], 1., ABS_ERROR) << "clamped";
+
+  for (float x = 1e-6; x < 4.; x *= 1.01)
+    ASSERT_NEAR(OutputTransform::fastLog2(x), std::log2(x), 1e-5) << "fastLog2(" << x << ")";
+}
+
 const unsigned SAMPLE_RATE = 44100;
 
 const unsigned SINE = 0;
@@ -176,3 +237,1163 @@ TEST(SlidingDFT, IntegrationBenchmark) {
     // char buf[20]; snprintf(buf, 20, "%.16f", output[kv.first]); cerr << buf << endl;
   }
 }
+
+TEST(SlidingDFT, BlockRate) {
+  // 8kHz makes the highest keys shorter than the blocks, which exercises the in-block expiration
+  const unsigned sampleRate = 8000;
+  auto blockSDFT = SlidingDFT(make_shared<PianoTuning>(sampleRate));
+  auto sampleSDFT = SlidingDFT(make_shared<PianoTuning>(sampleRate));
+  sampleSDFT.blockRate = false;
+
+  const unsigned blockSizes[] = { 128, 1, 37, 256 };
+  vector<float> input;
+  unsigned s = 0;
+  for (unsigned i = 0; i < 200; i++) {
+    const unsigned bufferSize = blockSizes[i % 4];
+    input.resize(bufferSize);
+    for (unsigned j = 0; j < bufferSize; j++)
+      input[j] = oscillator(s++, SAWTOOTH);
+
+    const float *blockOutput = blockSDFT.process(input.data(), bufferSize);
+    const float *sampleOutput = sampleSDFT.process(input.data(), bufferSize);
+    for (unsigned band = 0; band < blockSDFT.bands; band++)
+      ASSERT_NEAR(blockOutput[band], sampleOutput[band], ABS_ERROR) << "block #" << i << ", key #" << band;
+  }
+}
+
+TEST(SlidingDFT, SharedHistory) {
+  auto display = make_shared<PianoTuning>(SAMPLE_RATE);
+  auto transcription = make_shared<PianoTuning>(SAMPLE_RATE, 88, 48, 440., .5);
+  auto wide = make_shared<PianoTuning>(SAMPLE_RATE, 88, 48);
+
+  auto shared = SlidingDFT(display, -1.);
+  auto displayOnly = SlidingDFT(display, -1.);
+  auto transcriptionOnly = SlidingDFT(transcription);
+  auto wideOnly = SlidingDFT(wide);
+
+  const unsigned bufferSize = 128;
+  float input[bufferSize];
+  for (unsigned i = 0; i < bufferSize * 500; i++) {
+    unsigned j = i % bufferSize;
+    input[j] = oscillator(i, SAWTOOTH);
+    if (j == bufferSize - 1) {
+      shared.process(input, bufferSize, .05);
+      displayOnly.process(input, bufferSize, .05);
+      transcriptionOnly.process(input, bufferSize);
+      wideOnly.process(input, bufferSize);
+    }
+    // views can be added on-fly; their bins are primed from the history
+    if (i == bufferSize * 200 - 1) {
+      EXPECT_EQ(shared.addTuning(transcription), static_cast<unsigned>(1)) << "second view";
+      EXPECT_EQ(shared.addTuning(wide), static_cast<unsigned>(2)) << "third view";
+    }
+  }
+
+  EXPECT_EQ(shared.viewCount(), static_cast<unsigned>(3)) << "view count";
+  EXPECT_EQ(shared.viewBands(1), static_cast<unsigned>(88)) << "view bands";
+  // the 88-key wide tuning is a superset of the 61-key one (shifted by 15 keys)
+  EXPECT_EQ(shared.binCount(), static_cast<unsigned>(88 + 88)) << "bins de-duplicated";
+
+  for (unsigned band = 0; band < 61; band++)
+    EXPECT_NEAR(shared.viewLevels(0)[band], displayOnly.viewLevels(0)[band], ABS_ERROR) << "display, key #" << band;
+  for (unsigned band = 0; band < 88; band++) {
+    EXPECT_NEAR(shared.viewLevels(1)[band], transcriptionOnly.viewLevels(0)[band], ABS_ERROR) << "transcription, key #" << band;
+    EXPECT_NEAR(shared.viewLevels(2)[band], wideOnly.viewLevels(0)[band], ABS_ERROR) << "wide, key #" << band;
+  }
+
+  EXPECT_THROW(shared.addTuning(make_shared<PianoTuning>(48000)), invalid_argument) << "sample rate mismatch";
+}
+
+template <class StaticTuning>
+void testStaticTuning(PianoTuning runtime);
+template <class StaticTuning>
+void testStaticTuning(PianoTuning runtime) {
+  auto m = runtime.mapping();
+  ASSERT_EQ(m.size(), StaticTuning::keys) << "mapping size";
+  for (unsigned key = 0; key < StaticTuning::keys; key++) {
+    EXPECT_EQ(StaticTuning::table.k[key], m[key].k) << runtime.sampleRate << "Hz, key #" << key << " k";
+    EXPECT_EQ(StaticTuning::table.N[key], m[key].N) << runtime.sampleRate << "Hz, key #" << key << " N";
+  }
+}
+
+TEST(StaticPianoTuning, SameAsRuntime) {
+  testStaticTuning<StaticPianoTuning<44100>>(PianoTuning(44100));
+  testStaticTuning<StaticPianoTuning<48000>>(PianoTuning(48000));
+  testStaticTuning<StaticPianoTuning<24000, 72>>(PianoTuning(24000, 72));
+  testStaticTuning<StaticPianoTuning<8000, 88, 48, 44200, 50>>(PianoTuning(8000, 88, 48, 442., .5));
+
+  static_assert(StaticPianoTuning<44100>::table.N[0] == 11462, "C2 N evaluated at compile time");
+}
+
+TEST(StaticSlidingDFT, SameAsRuntime) {
+  const unsigned bufferSize = 128;
+  StaticSlidingDFT<StaticPianoTuning<SAMPLE_RATE>, bufferSize> staticSDFT;
+  auto sdft = SlidingDFT(make_shared<PianoTuning>(SAMPLE_RATE));
+  float input[bufferSize];
+  const float *staticOutput = nullptr;
+  const float *output = nullptr;
+
+  auto start = chrono::high_resolution_clock::now();
+  unsigned i;
+  for (i = 0; i < bufferSize * 10000; i++) {
+    unsigned j = i % bufferSize;
+    input[j] = oscillator(i, SAWTOOTH);
+    if (j == bufferSize - 1)
+      staticOutput = staticSDFT.process(input);
+  }
+  auto end = chrono::high_resolution_clock::now();
+  chrono::duration<double> elapsed = end - start;
+  cerr << "# benchmark: " << static_cast<int>(std::round(i / elapsed.count())) << " samples per second" << endl;
+
+  for (i = 0; i < bufferSize * 10000; i++) {
+    unsigned j = i % bufferSize;
+    input[j] = oscillator(i, SAWTOOTH);
+    if (j == bufferSize - 1)
+      output = sdft.process(input, bufferSize);
+  }
+
+  for (unsigned band = 0; band < sdft.bands; band++)
+    EXPECT_NEAR(staticOutput[band], output[band], ABS_ERROR) << "key #" << band;
+}
+
+TEST(OnsetBooster, BassLatencyAndFalseTriggers) {
+  auto tuning = make_shared<PianoTuning>(SAMPLE_RATE);
+  auto sdft = SlidingDFT(tuning);
+  const unsigned bins = sdft.binCount();
+  auto booster = OnsetBooster(sdft);
+  cerr << "# auxiliary bins: " << sdft.binCount() - bins << endl;
+
+  // plucked bass notes with a couple of harmonics, each after half a second of silence
+  const unsigned keys[] = { 0, 4, 9, 2, 7, 12, 16, 1 };
+  const unsigned bufferSize = 128;
+  const unsigned onset = SAMPLE_RATE / 2;
+  const float lit = .25;
+  float input[bufferSize];
+  double longLatency = 0., boostedLatency = 0.;
+  unsigned falseTriggers = 0;
+  for (auto key : keys) {
+    const double frequency = tuning->keyToFreq(key);
+    double longAt = -1., boostedAt = -1.;
+    vector<bool> wrong(tuning->bands);
+    for (unsigned block = 0; block < SAMPLE_RATE * 3 / 2 / bufferSize; block++) {
+      for (unsigned j = 0; j < bufferSize; j++) {
+        const unsigned s = block * bufferSize + j;
+        const double t = s < onset ? -1. : static_cast<double>(s - onset) / SAMPLE_RATE;
+        input[j] = t < 0. ? 0. : std::exp(-t) * (
+          std::sin(2. * M_PI * frequency * t) + .5 * std::sin(4. * M_PI * frequency * t) + .25 * std::sin(6. * M_PI * frequency * t)
+        );
+      }
+      const float *output = sdft.process(input, bufferSize);
+      const float *boosted = booster.update(sdft, bufferSize);
+
+      const double now = (static_cast<double>(block + 1) * bufferSize - onset) / SAMPLE_RATE;
+      if (now <= 0.)
+        continue;
+      if (longAt < 0. && output[key] >= lit)
+        longAt = now;
+      if (boostedAt < 0. && boosted[key] >= lit)
+        boostedAt = now;
+      // the octave, the twelfth & the double octave are the harmonics; lighting them up is legit
+      for (unsigned band = 0; band < tuning->bands; band++)
+        if (band != key && band != key + 12 && band != key + 19 && band != key + 24 && boosted[band] >= lit)
+          wrong[band] = true;
+    }
+    ASSERT_GE(longAt, 0.) << "key #" << key << " lit up";
+    ASSERT_GE(boostedAt, 0.) << "key #" << key << " lit up with the booster";
+    longLatency += longAt;
+    boostedLatency += boostedAt;
+    falseTriggers += static_cast<unsigned>(count(wrong.begin(), wrong.end(), true));
+  }
+
+  const unsigned notes = sizeof(keys) / sizeof(keys[0]);
+  cerr << "# benchmark: average latency " << std::round(1000. * longLatency / notes) << " ms without, "
+    << std::round(1000. * boostedLatency / notes) << " ms with the booster; "
+    << static_cast<double>(falseTriggers) / notes << " wrong keys lit up per onset" << endl;
+  EXPECT_LT(boostedLatency, longLatency / 3.) << "at least 3x faster";
+  EXPECT_LE(falseTriggers, notes) << "at most one wrong key per onset, on average";
+}
+
+TEST(OnsetBooster, FollowsRetune) {
+  auto sdft = SlidingDFT(make_shared<PianoTuning>(SAMPLE_RATE), -1.);
+  auto booster = OnsetBooster(sdft);
+  auto tuning = make_shared<PianoTuning>(SAMPLE_RATE, 61, 33, 445.);
+  sdft.retuneGradually(0, tuning);
+
+  // the booster notices the retune once it is complete, then moves the auxiliary view over
+  const unsigned bufferSize = 128;
+  const unsigned key = 2;
+  const unsigned onset = SAMPLE_RATE;
+  float input[bufferSize];
+  double boostedAt = -1.;
+  for (unsigned block = 0; block < onset * 2 / bufferSize; block++) {
+    for (unsigned j = 0; j < bufferSize; j++) {
+      const unsigned s = block * bufferSize + j;
+      input[j] = s < onset ? 0. : std::sin(2. * M_PI * tuning->keyToFreq(key) * (s - onset) / SAMPLE_RATE);
+    }
+    sdft.process(input, bufferSize);
+    const float *boosted = booster.update(sdft, bufferSize);
+    if (boostedAt < 0. && block * bufferSize >= onset && boosted[key] >= .25)
+      boostedAt = static_cast<double>((block + 1) * bufferSize - onset) / SAMPLE_RATE;
+  }
+
+  ASSERT_FALSE(sdft.retuning()) << "retunes complete";
+  ASSERT_EQ(sdft.viewTuning(0), tuning);
+  unsigned paired = 0;
+  for (unsigned band = 0; band < tuning->bands; band++) {
+    const auto bin = sdft.viewBin(0, band);
+    const auto shortBin = sdft.viewBin(booster.shortView, band);
+    if (shortBin->N == bin->N)
+      continue;
+    paired++;
+    const double frequency = static_cast<double>(bin->k) / bin->N;
+    const double shortFrequency = static_cast<double>(shortBin->k) / shortBin->N;
+    EXPECT_NEAR(1200. * std::log2(shortFrequency / frequency), 0., 10.) << "key #" << band << " paired in tune, in cents";
+  }
+  EXPECT_GT(paired, 0u) << "some bands paired";
+  EXPECT_GE(boostedAt, 0.) << "boosted after the retune";
+  EXPECT_LT(boostedAt, .1) << "lit up quickly";
+}
+
+TEST(HopDFT, SameAsSlidingDFT) {
+  auto tuning = make_shared<PianoTuning>(SAMPLE_RATE);
+  cerr << "# crossover: " << static_cast<int>(std::round(HopDFT::crossover(tuning))) << " samples per hop (estimated)" << endl;
+
+  const unsigned hopSizes[] = { 256, 1024, 4096, 16384 };
+  for (auto hopSize : hopSizes) {
+    auto sdft = SlidingDFT(tuning);
+    auto hopDFT = HopDFT(tuning);
+    vector<float> input(hopSize);
+    const float *output = nullptr;
+    const float *hopOutput = nullptr;
+    chrono::duration<double> sdftElapsed(0), hopElapsed(0);
+
+    const unsigned hops = SAMPLE_RATE * 5 / hopSize;
+    for (unsigned hop = 0; hop < hops; hop++) {
+      for (unsigned j = 0; j < hopSize; j++)
+        input[j] = oscillator(hop * hopSize + j, SAWTOOTH);
+      auto start = chrono::high_resolution_clock::now();
+      output = sdft.process(input.data(), hopSize);
+      auto middle = chrono::high_resolution_clock::now();
+      hopOutput = hopDFT.process(input.data(), hopSize);
+      auto end = chrono::high_resolution_clock::now();
+      sdftElapsed += middle - start;
+      hopElapsed += end - middle;
+    }
+
+    cerr << "# benchmark: hop size " << hopSize << "; SlidingDFT: "
+      << static_cast<int>(std::round(hops * hopSize / sdftElapsed.count())) << ", HopDFT: "
+      << static_cast<int>(std::round(hops * hopSize / hopElapsed.count())) << " samples per second" << endl;
+    for (unsigned band = 0; band < tuning->bands; band++)
+      EXPECT_NEAR(output[band], hopOutput[band], ABS_ERROR) << "hop size " << hopSize << ", key #" << band;
+  }
+
+  EXPECT_FALSE(HopDFT::preferred(tuning, 256));
+  EXPECT_TRUE(HopDFT::preferred(tuning, 16384));
+}
+
+TEST(SlidingDFT, Query) {
+  auto tuning = make_shared<PianoTuning>(SAMPLE_RATE);
+  auto sdft = SlidingDFT(tuning);
+  vector<float> input(SAMPLE_RATE / 2);
+  for (unsigned i = 0; i < input.size(); i++)
+    input[i] = oscillator(i, SAWTOOTH);
+  const float *output = sdft.process(input.data(), input.size());
+  const unsigned bins = sdft.binCount();
+
+  // the bands themselves; A4 is k=17, N=1704
+  const auto mapping = tuning->mapping();
+  for (unsigned band = 0; band < tuning->bands; band += 11) {
+    const double frequency = static_cast<double>(SAMPLE_RATE) * mapping[band].k / mapping[band].N;
+    EXPECT_NEAR(sdft.query(frequency, mapping[band].N), output[band], ABS_ERROR) << "same as the band #" << band;
+  }
+
+  // off the tuning: the fundamental (441Hz) & harmonics of the sawtooth, and the gaps between them
+  const double frequencies[] = { 441., 882., 1323., 661.5, 441., 3000. };
+  const unsigned windowLengths[] = { 4410, 4410, 1000, 4410, 100, 4410 };
+  float levels[6];
+  sdft.query(frequencies, windowLengths, 6, levels);
+  for (unsigned i = 0; i < 6; i++)
+    EXPECT_NEAR(levels[i], sdft.query(frequencies[i], windowLengths[i]), 1e-6) << "batch same as one by one";
+  // the n-th harmonic of a sawtooth carries 6 / (pi * n)^2 of its power
+  const double fundamental = 6. / (M_PI * M_PI);
+  EXPECT_NEAR(levels[0], fundamental, 2e-3) << "fundamental";
+  EXPECT_NEAR(levels[1], fundamental / 4, 1e-3) << "2nd harmonic";
+  EXPECT_NEAR(levels[2], fundamental / 9, 1e-3) << "3rd harmonic, shorter window";
+  EXPECT_LT(levels[3], ABS_ERROR) << "between the harmonics";
+  EXPECT_GT(levels[4], .5) << "one period catches the fundamental, too";
+  EXPECT_LT(levels[5], ABS_ERROR) << "between the harmonics";
+
+  EXPECT_EQ(sdft.binCount(), bins) << "no bins added";
+  EXPECT_GE(sdft.historyLength(), mapping[0].N) << "history holds the longest band";
+  EXPECT_THROW(sdft.query(441., sdft.historyLength() + 1), invalid_argument) << "window longer than the history";
+  EXPECT_THROW(sdft.query(441., 0), invalid_argument) << "empty window";
+}
+
+TEST(SlidingDFT, BandLimit) {
+  auto tuning = make_shared<PianoTuning>(SAMPLE_RATE);
+  auto sdft = SlidingDFT(tuning, -1.);
+  auto reference = SlidingDFT(tuning, -1.);
+  const unsigned bufferSize = 256;
+  float input[bufferSize];
+  const float *output = nullptr;
+  const float *referenceOutput = nullptr;
+
+  for (unsigned block = 0; block < 300; block++) {
+    for (unsigned j = 0; j < bufferSize; j++)
+      input[j] = oscillator(block * bufferSize + j, SAWTOOTH);
+    // shed the top octave for a while; alternate the block & the per-sample paths
+    if (block == 100)
+      sdft.bandLimit(tuning->keyToFreq(48.5));
+    if (block == 200)
+      sdft.bandLimit(0.);
+    const double averageWindow = block % 2 ? .02 : 0.;
+    output = sdft.process(input, bufferSize, averageWindow);
+    referenceOutput = reference.process(input, bufferSize, averageWindow);
+
+    if (block == 199) {
+      for (unsigned band = 0; band < tuning->bands; band++) {
+        if (band > 48)
+          ASSERT_EQ(output[band], 0.f) << "key #" << band << " is shed";
+        else
+          ASSERT_NEAR(output[band], referenceOutput[band], ABS_ERROR) << "key #" << band << " carries on";
+      }
+    }
+  }
+
+  for (unsigned band = 0; band < tuning->bands; band++)
+    EXPECT_NEAR(output[band], referenceOutput[band], ABS_ERROR) << "key #" << band << " restored";
+}
+
+TEST(SlidingDFT, Reset) {
+  auto tuning = make_shared<PianoTuning>(SAMPLE_RATE);
+  auto sdft = BasicSlidingDFT<CompactRingBuffer>(tuning, -1.);
+  const unsigned bufferSize = 256;
+  float input[bufferSize];
+
+  // something else entirely first, with both kernels, then the same as a fresh instance gets
+  for (unsigned block = 0; block < 100; block++) {
+    for (unsigned j = 0; j < bufferSize; j++)
+      input[j] = oscillator(block * bufferSize + j, SQUARE);
+    sdft.process(input, bufferSize, block % 2 ? .05 : 0.);
+  }
+  sdft.reset();
+
+  auto fresh = BasicSlidingDFT<CompactRingBuffer>(tuning, -1.);
+  for (unsigned block = 0; block < 100; block++) {
+    for (unsigned j = 0; j < bufferSize; j++)
+      input[j] = oscillator(block * bufferSize + j, SAWTOOTH);
+    const double averageWindow = block < 50 ? .02 : 0.;
+    const float *output = sdft.process(input, bufferSize, averageWindow);
+    const float *freshOutput = fresh.process(input, bufferSize, averageWindow);
+    for (unsigned band = 0; band < tuning->bands; band++)
+      ASSERT_EQ(output[band], freshOutput[band]) << "key #" << band << ", block #" << block;
+  }
+}
+
+TEST(SlidingDFT, CompactHistoryAccuracy) {
+  // the configuration that outgrows the L2 cache with the float history
+  const unsigned sampleRate = 96000;
+  auto tuning = make_shared<PianoTuning>(sampleRate, 88, 48);
+  const unsigned maxN = tuning->mapping()[0].N;
+  cerr << "# history: " << RingBuffer(maxN + 1).size * sizeof(float) << " bytes as float, "
+    << CompactRingBuffer(maxN + 1).size * sizeof(int16_t) << " bytes as int16" << endl;
+
+  // full scale & -40dB; averaged (per-sample path) & not (block path)
+  const double amplitudes[] = { 1., .01 };
+  const double averageWindows[] = { .05, 0. };
+  for (auto amplitude : amplitudes) {
+    for (auto averageWindow : averageWindows) {
+      auto reference = BasicSlidingDFT<RingBuffer>(tuning, -1.);
+      auto compact = BasicSlidingDFT<CompactRingBuffer>(tuning, -1.);
+      const unsigned bufferSize = 256;
+      float input[bufferSize];
+      double maxError = 0.;
+      for (unsigned block = 0; block < sampleRate / bufferSize; block++) {
+        for (unsigned j = 0; j < bufferSize; j++) {
+          const unsigned s = block * bufferSize + j;
+          input[j] = amplitude * (.5 * std::sin(2. * M_PI * 220. / sampleRate * s) + .4 * (((s % 300) / 150.) - 1.));
+        }
+        const float *expected = reference.process(input, bufferSize, averageWindow);
+        const float *output = compact.process(input, bufferSize, averageWindow);
+        for (unsigned band = 0; band < tuning->bands; band++)
+          maxError = std::max(maxError, static_cast<double>(std::fabs(output[band] - expected[band])));
+      }
+      cerr << "# accuracy: amplitude " << amplitude << ", average window " << averageWindow
+        << "s: max level error " << maxError << endl;
+      EXPECT_LT(maxError, amplitude < 1. ? 1e-3 : ABS_ERROR) << "amplitude " << amplitude;
+    }
+  }
+}
+
+TEST(SlidingDFT, RetuneAndCalibrate) {
+  // A4 of the "instrument" is 445Hz; the analyzer starts at 440Hz
+  const double pitchFork = 445.;
+  auto sdft = SlidingDFT(make_shared<PianoTuning>(SAMPLE_RATE), -1.);
+  auto reference = SlidingDFT(make_shared<PianoTuning>(SAMPLE_RATE, 61, 33, pitchFork), -1.);
+  auto calibrator = PitchCalibrator();
+
+  const unsigned bufferSize = 128;
+  float input[bufferSize];
+  bool retuned = false;
+  const float *output = nullptr;
+  const float *referenceOutput = nullptr;
+  for (unsigned i = 0; i < bufferSize * 2000; i++) {
+    unsigned j = i % bufferSize;
+    input[j] = std::sin(2. * M_PI * pitchFork / SAMPLE_RATE * i);
+    if (j == bufferSize - 1) {
+      output = sdft.process(input, bufferSize, .01);
+      referenceOutput = reference.process(input, bufferSize, .01);
+      if (!retuned) {
+        calibrator.update(sdft, bufferSize);
+        if ((retuned = calibrator.calibrate(sdft))) {
+          EXPECT_NEAR(calibrator.pitchFork, pitchFork, .5) << "calibrated pitch fork";
+          EXPECT_LT(i, bufferSize * 1500) << "calibrated in time to check the state afterwards";
+        }
+      }
+    }
+  }
+
+  ASSERT_TRUE(retuned) << "calibration happened";
+  EXPECT_FALSE(sdft.retuning()) << "retune complete";
+  EXPECT_EQ(sdft.binCount(), static_cast<unsigned>(61)) << "old bins dropped";
+  for (unsigned band = 0; band < 61; band++)
+    EXPECT_NEAR(output[band], referenceOutput[band], ABS_ERROR) << "key #" << band;
+
+  EXPECT_THROW(sdft.retune(0, make_shared<PianoTuning>(SAMPLE_RATE, 88)), invalid_argument) << "band count mismatch";
+}
+
+TEST(PitchTracker, Oscillators) {
+  auto tuning = make_shared<PianoTuning>(SAMPLE_RATE);
+  const unsigned bufferSize = 256;
+  float input[bufferSize];
+
+  // the oscillators are at 441Hz, 3.93 cents above A4; the sawtooth harmonics, above A5 & E6
+  const double above = 1200. * std::log2(441. / 440.);
+  const unsigned types[] = { SINE, SAWTOOTH };
+  for (auto type : types) {
+    auto sdft = SlidingDFT(tuning);
+    // the harmonics leak into each other's bins; measuring over 8 blocks (46ms) averages that out
+    auto tracker = PitchTracker(0, type == SINE ? 1 : 8);
+    tracker.threshold = .05;
+    chrono::duration<double> sdftElapsed(0), trackerElapsed(0);
+    const float *cents = nullptr;
+    for (unsigned block = 0; block < 200; block++) {
+      for (unsigned j = 0; j < bufferSize; j++)
+        input[j] = oscillator(block * bufferSize + j, type);
+      auto start = chrono::high_resolution_clock::now();
+      sdft.process(input, bufferSize);
+      auto middle = chrono::high_resolution_clock::now();
+      cents = tracker.update(sdft, bufferSize);
+      auto end = chrono::high_resolution_clock::now();
+      sdftElapsed += middle - start;
+      trackerElapsed += end - middle;
+    }
+
+    const string prefix = "oscillator #" + to_string(type) + "; ";
+    EXPECT_NEAR(cents[33], above, .15) << prefix + "A4";
+    EXPECT_NEAR(tracker.frequencies()[33], 441., .04) << prefix + "A4 in Hz";
+    EXPECT_FALSE(tracker.measured(0)) << prefix + "C2 is below the threshold";
+    EXPECT_EQ(cents[0], 0.f) << prefix + "C2 is below the threshold";
+    if (type == SAWTOOTH) {
+      EXPECT_NEAR(cents[45], above, 1.) << prefix + "A5, 2nd harmonic";
+      EXPECT_NEAR(cents[52], 1200. * std::log2(1323. / tuning->keyToFreq(52)), 1.) << prefix + "E6, 3rd harmonic";
+    } else {
+      cerr << "# benchmark: pitch tracking takes " << std::round(100. * trackerElapsed.count() / sdftElapsed.count())
+        << "% of the SlidingDFT time" << endl;
+    }
+  }
+
+  // a flat tone, and then a bend up by a semitone, over 0.2 seconds
+  auto sdft = SlidingDFT(tuning);
+  auto tracker = PitchTracker();
+  double phase = 0.;
+  const float *cents = nullptr;
+  for (unsigned block = 0; block < 200; block++) {
+    const double bend = block < 100 ? -30. : std::min(-30. + (block - 100) * 100. / 35., 70.);
+    const double frequency = 440. * std::pow(2., bend / 1200.);
+    for (unsigned j = 0; j < bufferSize; j++) {
+      input[j] = std::sin(phase);
+      phase += 2. * M_PI * frequency / SAMPLE_RATE;
+    }
+    sdft.process(input, bufferSize);
+    cents = tracker.update(sdft, bufferSize);
+    if (block == 99) {
+      EXPECT_NEAR(cents[33], -30., .25) << "flat A4";
+    }
+  }
+  EXPECT_NEAR(cents[34], -30., 1.) << "bent up to the flat A#4";
+}
+
+TEST(SlidingDFT, RetuneKeepsWarmState) {
+  auto sdft = SlidingDFT(make_shared<PianoTuning>(SAMPLE_RATE));
+  auto reference = SlidingDFT(make_shared<PianoTuning>(SAMPLE_RATE, 61, 33, 442.));
+
+  const unsigned bufferSize = 128;
+  float input[bufferSize];
+  const float *output = nullptr;
+  const float *referenceOutput = nullptr;
+  for (unsigned i = 0; i < bufferSize * 200; i++) {
+    unsigned j = i % bufferSize;
+    input[j] = oscillator(i, SAWTOOTH);
+    if (j == bufferSize - 1) {
+      output = sdft.process(input, bufferSize);
+      referenceOutput = reference.process(input, bufferSize);
+      if (i == bufferSize * 150 - 1)
+        sdft.retune(0, make_shared<PianoTuning>(SAMPLE_RATE, 61, 33, 442.));
+    }
+  }
+
+  for (unsigned band = 0; band < 61; band++)
+    EXPECT_NEAR(output[band], referenceOutput[band], ABS_ERROR) << "key #" << band;
+}
+
+TEST(SlidingDFT, RetuneGradually) {
+  const unsigned bufferSize = 128;
+  float input[bufferSize];
+  const unsigned types[] = { SAWTOOTH, SINE };
+  for (auto type : types) {
+    // the sine goes through the per-sample kernel (with a moving average); the sawtooth, through the block-rate one
+    const double averageWindow = type == SINE ? .01 : 0.;
+    auto sdft = SlidingDFT(make_shared<PianoTuning>(SAMPLE_RATE), -1.);
+    auto reference = SlidingDFT(make_shared<PianoTuning>(SAMPLE_RATE, 61, 33, 442.), -1.);
+    auto target = make_shared<PianoTuning>(SAMPLE_RATE, 61, 33, 442.);
+    const float *output = nullptr;
+    const float *referenceOutput = nullptr;
+    unsigned retuneBlocks = 0;
+    for (unsigned block = 0; block < 400; block++) {
+      for (unsigned j = 0; j < bufferSize; j++)
+        input[j] = oscillator(block * bufferSize + j, type);
+      if (block == 150) {
+        sdft.retuneGradually(0, target);
+        EXPECT_TRUE(sdft.retuning()) << "the new bins are not primed yet";
+        EXPECT_NE(sdft.viewTuning(0), target) << "the tuning changes once all the bands moved";
+      }
+      output = sdft.process(input, bufferSize, averageWindow);
+      referenceOutput = reference.process(input, bufferSize, averageWindow);
+      if (sdft.retuning())
+        retuneBlocks++;
+    }
+
+    const string prefix = "oscillator #" + to_string(type) + "; ";
+    EXPECT_FALSE(sdft.retuning()) << prefix + "retune complete";
+    EXPECT_GT(retuneBlocks, 4u) << prefix + "spread over several blocks";
+    EXPECT_LT(retuneBlocks, 200u) << prefix + "but not forever";
+    EXPECT_EQ(sdft.viewTuning(0), target) << prefix + "tuning swapped in";
+    EXPECT_EQ(sdft.binCount(), static_cast<unsigned>(61)) << prefix + "old bins dropped";
+    for (unsigned band = 0; band < 61; band++)
+      EXPECT_NEAR(output[band], referenceOutput[band], ABS_ERROR) << prefix + "key #" << band;
+  }
+}
+
+TEST(Spectrogram, RoundTripAndSeek) {
+  auto tuning = make_shared<PianoTuning>(SAMPLE_RATE);
+  auto sdft = SlidingDFT(tuning, -1.);
+  auto transform = OutputTransform(tuning->bands);
+  const string path = "/tmp/pianolizer-test-" + to_string(getpid()) + ".pnlz";
+
+  // 1000 frames (that is, 3 full chunks & a partial one) of a tone that comes & goes
+  const unsigned hopSize = 256, frameCount = 1000, bands = tuning->bands;
+  vector<uint8_t> expected;
+  {
+    SpectrogramWriter writer(path, tuning, hopSize, transform.scale, 256);
+    float input[hopSize];
+    uint8_t values[61];
+    for (unsigned frame = 0; frame < frameCount; frame++) {
+      for (unsigned j = 0; j < hopSize; j++)
+        input[j] = (frame / 100) % 2 ? oscillator(frame * hopSize + j, SAWTOOTH) : 0.;
+      transform.apply(sdft.process(input, hopSize, .05), values);
+      writer.write(values);
+      expected.insert(expected.end(), values, values + bands);
+    }
+  }
+
+  FILE *file = fopen(path.c_str(), "rb");
+  fseek(file, 0, SEEK_END);
+  const long archiveSize = ftell(file);
+  fclose(file);
+  cerr << "# archive: " << archiveSize << " bytes for " << frameCount * (2 * bands + 1) << " bytes of hex output" << endl;
+  EXPECT_LT(archiveSize, static_cast<long>(frameCount * bands / 4)) << "compact";
+
+  SpectrogramReader reader(path);
+  EXPECT_EQ(reader.sampleRate, SAMPLE_RATE);
+  EXPECT_EQ(reader.bands, bands);
+  EXPECT_EQ(reader.hopSize, hopSize);
+  EXPECT_EQ(reader.frames, static_cast<uint64_t>(frameCount));
+  EXPECT_EQ(reader.referenceKey, static_cast<unsigned>(33));
+  EXPECT_DOUBLE_EQ(reader.pitchFork, 440.);
+  EXPECT_EQ(reader.mapping[33].N, static_cast<unsigned>(1704));
+
+  // crosses a chunk boundary; picks a subset of the keys; runs past the end
+  const uint64_t firstFrame = 700;
+  const unsigned firstBand = 30, bandCount = 7;
+  vector<uint8_t> values(400 * bandCount);
+  ASSERT_EQ(reader.read(firstFrame, 400, firstBand, bandCount, values.data()), static_cast<uint64_t>(300));
+  for (unsigned row = 0; row < 300; row++)
+    for (unsigned band = 0; band < bandCount; band++)
+      ASSERT_EQ(values[row * bandCount + band], expected[(firstFrame + row) * bands + firstBand + band]) << "frame #" << firstFrame + row << ", key #" << firstBand + band;
+  EXPECT_EQ(reader.frameAt(1.), static_cast<uint64_t>(172));
+  EXPECT_THROW(reader.read(0, 1, 60, 2, values.data()), out_of_range);
+
+  // an archive that was never closed (no index, no frame count) is still readable
+  file = fopen(path.c_str(), "r+b");
+  const uint8_t zeros[16] = {};
+  fseek(file, static_cast<long>(SpectrogramFormat::framesOffset), SEEK_SET);
+  fwrite(zeros, 1, sizeof(zeros), file);
+  fclose(file);
+  SpectrogramReader recovered(path);
+  EXPECT_EQ(recovered.frames, static_cast<uint64_t>(frameCount)) << "chunks scanned";
+  ASSERT_EQ(recovered.read(990, 10, 0, bands, values.data()), static_cast<uint64_t>(10));
+  EXPECT_EQ(memcmp(values.data(), expected.data() + 990 * bands, 10 * bands), 0);
+
+  unlink(path.c_str());
+}
+
+TEST(Spectrogram, ClosedAfterInterrupt) {
+  auto tuning = make_shared<PianoTuning>(SAMPLE_RATE);
+  const string path = "/tmp/pianolizer-test-" + to_string(getpid()) + ".pnlz";
+  int progress[2];
+  ASSERT_EQ(pipe(progress), 0);
+
+  // the CLI loop, in another process: record until interrupted, then close the archive
+  const pid_t child = fork();
+  ASSERT_NE(child, -1);
+  if (child == 0) {
+    Interrupt::install();
+    SpectrogramWriter writer(path, tuning, 256, OutputTransform::LINEAR, 256);
+    vector<uint8_t> values(tuning->bands);
+    uint64_t frames = 0;
+    while (!Interrupt::requested()) {
+      fill(values.begin(), values.end(), static_cast<uint8_t>(frames));
+      writer.write(values.data());
+      // enough for a full chunk & a partial one, then report in
+      if (++frames == 300 && write(progress[1], &frames, sizeof(frames)) != sizeof(frames))
+        _exit(1);
+      usleep(100);
+    }
+    writer.close();
+    _exit(write(progress[1], &frames, sizeof(frames)) == sizeof(frames) ? 0 : 1);
+  }
+
+  uint64_t frames = 0;
+  ASSERT_EQ(read(progress[0], &frames, sizeof(frames)), static_cast<ssize_t>(sizeof(frames)));
+  kill(child, SIGINT);
+  int status;
+  ASSERT_EQ(waitpid(child, &status, 0), child);
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0) << "exited by itself";
+  ASSERT_EQ(read(progress[0], &frames, sizeof(frames)), static_cast<ssize_t>(sizeof(frames)));
+  close(progress[0]);
+  close(progress[1]);
+
+  // closed properly: the frame count is in the header (not recovered by a scan), & the pending chunk made it
+  FILE *file = fopen(path.c_str(), "rb");
+  uint8_t count[8];
+  fseek(file, static_cast<long>(SpectrogramFormat::framesOffset), SEEK_SET);
+  ASSERT_EQ(fread(count, 1, sizeof(count), file), sizeof(count));
+  fclose(file);
+  EXPECT_EQ(SpectrogramFormat::getU64(count), frames) << "frame count written on close";
+  SpectrogramReader reader(path);
+  ASSERT_EQ(reader.frames, frames);
+  vector<uint8_t> last(tuning->bands);
+  ASSERT_EQ(reader.read(frames - 1, 1, 0, tuning->bands, last.data()), static_cast<uint64_t>(1));
+  EXPECT_EQ(last[0], static_cast<uint8_t>(frames - 1)) << "last frame";
+  unlink(path.c_str());
+}
+
+TEST(CAPI, ProcessMatrix) {
+  pianolizer_config_t config;
+  pianolizer_config_init(&config);
+  config.channels = 2;
+  pianolizer_t *analyzer = pianolizer_create(&config);
+  ASSERT_NE(analyzer, nullptr) << pianolizer_error();
+  EXPECT_EQ(pianolizer_bands(analyzer), static_cast<unsigned>(61)) << "bands";
+  EXPECT_EQ(pianolizer_sample_rate(analyzer), SAMPLE_RATE) << "sample rate";
+
+  vector<unsigned> k(61), n(61);
+  pianolizer_mapping(analyzer, k.data(), n.data());
+  EXPECT_EQ(k[33], static_cast<unsigned>(17)) << "A4 k";
+  EXPECT_EQ(n[33], static_cast<unsigned>(1704)) << "A4 N";
+
+  // same signal on both channels; the mixdown doubles the amplitude, which the normalization cancels out
+  const unsigned bufferSize = 128;
+  const unsigned frames = bufferSize * 10000;
+  vector<float> input(frames * 2);
+  for (unsigned i = 0; i < frames; i++)
+    input[2 * i] = input[2 * i + 1] = oscillator(i, SAWTOOTH) / 2.;
+  vector<float> levels(10000 * 61);
+  EXPECT_EQ(pianolizer_process(analyzer, input.data(), frames, bufferSize, .05, levels.data()), 10000) << "rows";
+
+  auto sdft = SlidingDFT(make_shared<PianoTuning>(SAMPLE_RATE), -1.);
+  const float *output = nullptr;
+  for (unsigned i = 0; i < frames; i += bufferSize) {
+    vector<float> block(bufferSize);
+    for (unsigned j = 0; j < bufferSize; j++)
+      block[j] = oscillator(i + j, SAWTOOTH);
+    output = sdft.process(block.data(), bufferSize, .05);
+  }
+  for (unsigned band = 0; band < 61; band++) {
+    EXPECT_NEAR(levels[9999 * 61 + band], output[band], ABS_ERROR) << "last row, key #" << band;
+    EXPECT_EQ(pianolizer_levels(analyzer)[band], levels[9999 * 61 + band]) << "latest levels, key #" << band;
+  }
+
+  EXPECT_EQ(pianolizer_process(analyzer, input.data(), frames, 0, 0., levels.data()), -1) << "invalid block size";
+  EXPECT_STRNE(pianolizer_error(), "") << "error message";
+  pianolizer_destroy(analyzer);
+
+  config.tolerance = 0.;
+  EXPECT_EQ(pianolizer_create(&config), nullptr) << "invalid tolerance";
+
+  pianolizer_config_init(&config);
+  config.struct_size = sizeof(size_t) + sizeof(unsigned);
+  EXPECT_EQ(pianolizer_create(&config), nullptr) << "struct_size too small";
+  config.struct_size = sizeof(pianolizer_config_t) + 8;
+  EXPECT_EQ(pianolizer_create(&config), nullptr) << "struct_size from a newer header";
+}
+
+int connectUnix(const string& path);
+int connectUnix(const string& path) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1)
+    throw runtime_error(strerror(errno));
+  return fd;
+}
+
+TEST(FanOutServer, LocalClients) {
+  const string path = "/tmp/pianolizer-test-" + to_string(getpid()) + ".sock";
+  FanOutServer server("unix:" + path, 4);
+
+  const int fast = connectUnix(path);
+  const int slow = connectUnix(path);
+  const int latest = connectUnix(path);
+  ASSERT_EQ(send(latest, "latest\n", 7, 0), 7) << "mode switch sent";
+  for (unsigned i = 0; i < 10 && server.size() < 3; i++)
+    server.poll(100);
+  server.poll(100);
+  ASSERT_EQ(server.size(), static_cast<size_t>(3)) << "all clients connected";
+
+  // frames large enough to fill the socket buffers of the clients that do not read
+  const string filler(65536, 'x');
+  string received;
+  char buffer[65536];
+  for (unsigned i = 0; i < 64; i++) {
+    server.broadcast(to_string(i % 10) + filler.substr(1));
+    server.poll();
+    ssize_t len;
+    while ((len = recv(fast, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+      received.append(buffer, static_cast<size_t>(len));
+  }
+  for (unsigned i = 0; i < 100 && received.size() < 64 * filler.size(); i++) {
+    server.poll(10);
+    ssize_t len;
+    while ((len = recv(fast, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+      received.append(buffer, static_cast<size_t>(len));
+  }
+
+  EXPECT_EQ(received.size(), 64 * filler.size()) << "reading client got every frame";
+  EXPECT_EQ(received[63 * filler.size()], '3') << "last frame in place";
+
+  for (auto stats : server.stats()) {
+    if (stats.sent == 64)
+      continue; // the reading client
+    if (stats.latest) {
+      EXPECT_LE(stats.queued, static_cast<size_t>(2)) << "latest-only client keeps at most the current & the newest frame";
+    } else {
+      EXPECT_LE(stats.queued, static_cast<size_t>(5)) << "queue is bounded";
+      EXPECT_GT(stats.dropped, static_cast<unsigned long>(0)) << "slow client dropped frames";
+    }
+  }
+
+  close(slow);
+  close(latest);
+  for (unsigned i = 0; i < 10 && server.size() > 1; i++) {
+    server.broadcast("x");
+    server.poll(10);
+  }
+  EXPECT_EQ(server.size(), static_cast<size_t>(1)) << "disconnected clients are gone";
+  close(fast);
+}
+
+TEST(FanOutServer, KeepsRegularFiles) {
+  const string path = "/tmp/pianolizer-test-" + to_string(getpid()) + ".hex";
+  FILE *file = fopen(path.c_str(), "w");
+  ASSERT_NE(file, nullptr);
+  fputs("frames\n", file);
+  fclose(file);
+  EXPECT_THROW(FanOutServer{ "unix:" + path }, runtime_error) << "not a socket";
+  EXPECT_EQ(access(path.c_str(), F_OK), 0) << "the file is still there";
+  EXPECT_THROW(FanOutServer{ path }, invalid_argument) << "a path without unix: is not a socket address";
+  EXPECT_EQ(access(path.c_str(), F_OK), 0) << "the file is still there";
+  unlink(path.c_str());
+
+  // the socket left over by a previous run is replaced
+  const string socketPath = "/tmp/pianolizer-test-" + to_string(getpid()) + ".sock";
+  const int stale = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+  ASSERT_EQ(bind(stale, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+  close(stale);
+  EXPECT_NO_THROW(FanOutServer{ "unix:" + socketPath }) << "stale socket replaced";
+}
+
+TEST(FanOutServer, ServesWhileInputStalls) {
+  const string path = "/tmp/pianolizer-test-" + to_string(getpid()) + ".sock";
+  FanOutServer server("unix:" + path, 4);
+  int input[2];
+  ASSERT_EQ(pipe(input), 0);
+
+  // the input only arrives after the client connected
+  const int client = connectUnix(path);
+  thread writer([&input]() {
+    this_thread::sleep_for(chrono::milliseconds(100));
+    EXPECT_EQ(write(input[1], "x", 1), 1);
+  });
+  EXPECT_TRUE(server.serveUntilReadable(input[0])) << "the input became readable";
+  writer.join();
+  EXPECT_EQ(server.size(), static_cast<size_t>(1)) << "the client got accepted while waiting for the input";
+
+  close(client);
+  close(input[0]);
+  close(input[1]);
+}
+
+// reads the whole stream, checking that every frame is in place; returns the number of errors
+static int readRamp(SharedRingReader& ring, const uint64_t total) {
+  int errors = 0;
+  uint64_t expected = 0, consumed = 0;
+  unsigned long dropped = 0;
+  size_t frames = 256;
+  const float *block;
+  while ((block = ring.acquire(frames)) != nullptr) {
+    expected += ring.dropped - dropped;
+    consumed += ring.dropped - dropped;
+    dropped = ring.dropped;
+    int blockErrors = 0;
+    for (size_t i = 0; i < frames; i++) {
+      const float value = static_cast<float>(expected + i);
+      if (block[2 * i] != value || block[2 * i + 1] != -value)
+        blockErrors++;
+    }
+    // a block overwritten while being checked is not an error of the ring
+    if (ring.release())
+      errors += blockErrors;
+    expected += frames;
+    consumed += frames;
+    frames = 256;
+  }
+  return errors + (consumed == total ? 0 : 1000);
+}
+
+TEST(SharedRing, ProcessesAndLaggards) {
+  const string name = "pianolizer-test-" + to_string(getpid());
+  SharedRingWriter writer(name, 2, 8000, 4000);
+  SharedRingReader laggard(name);
+  EXPECT_EQ(laggard.channels(), 2u) << "channels";
+  EXPECT_EQ(laggard.sampleRate(), 8000u) << "sample rate";
+  EXPECT_EQ(laggard.capacity(), 4096u) << "capacity rounded up to whole pages";
+
+  int ready[2];
+  ASSERT_EQ(pipe(ready), 0);
+  const pid_t child = fork();
+  ASSERT_NE(child, -1);
+  if (child == 0) {
+    SharedRingReader reader(name);
+    char byte = 1;
+    if (write(ready[1], &byte, 1) != 1)
+      _exit(255);
+    _exit(min(readRamp(reader, 20256), 254));
+  }
+  char byte;
+  ASSERT_EQ(read(ready[0], &byte, 1), 1) << "reading process attached";
+  close(ready[0]);
+  close(ready[1]);
+
+  // blocks of 100 frames wrap around the end of the ring in the middle
+  const uint64_t total = 20000;
+  float block[200];
+  for (uint64_t start = 0; start < total; start += 100) {
+    for (unsigned i = 0; i < 100; i++) {
+      block[2 * i] = static_cast<float>(start + i);
+      block[2 * i + 1] = -block[2 * i];
+    }
+    writer.write(block, 100);
+    usleep(100);
+  }
+  EXPECT_EQ(writer.sequence(), total) << "sequence counter";
+
+  size_t frames = 256;
+  const float *latest = laggard.acquire(frames);
+  ASSERT_NE(latest, nullptr);
+  EXPECT_EQ(laggard.dropped, total - 256) << "laggard skipped to the most recent block";
+  EXPECT_EQ(latest[0], static_cast<float>(total - 256)) << "most recent block";
+  EXPECT_EQ(latest[2 * 255 + 1], -static_cast<float>(total - 1)) << "most recent block";
+  EXPECT_TRUE(laggard.release()) << "nothing overwritten yet";
+
+  float *claimed = writer.claim(256);
+  for (unsigned i = 0; i < 256; i++) {
+    claimed[2 * i] = static_cast<float>(total + i);
+    claimed[2 * i + 1] = -claimed[2 * i];
+  }
+  writer.publish(256);
+  frames = 256;
+  latest = laggard.acquire(frames, 0);
+  ASSERT_NE(latest, nullptr);
+  EXPECT_EQ(latest[0], static_cast<float>(total)) << "in place block";
+  frames = 256;
+  EXPECT_EQ(laggard.acquire(frames, 0), nullptr) << "no more frames yet";
+  EXPECT_EQ(frames, 0u) << "no more frames yet";
+  writer.close();
+
+  int status;
+  ASSERT_EQ(waitpid(child, &status, 0), child);
+  ASSERT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(WEXITSTATUS(status), 0) << "reading process got every frame in order";
+
+  EXPECT_TRUE(laggard.ended()) << "stream ended";
+}
+
+TEST(SharedRing, TornBlock) {
+  const string name = "pianolizer-test-" + to_string(getpid());
+  SharedRingWriter writer(name, 1, 8000, 1024);
+  SharedRingReader reader(name);
+  vector<float> block(reader.capacity(), 1.f);
+
+  writer.write(block.data(), 256);
+  size_t frames = 256;
+  ASSERT_NE(reader.acquire(frames), nullptr);
+  writer.write(block.data(), reader.capacity() - 256);
+  EXPECT_TRUE(reader.release()) << "the writer stopped right before the block";
+  writer.write(block.data(), 256);
+  ASSERT_NE(reader.acquire(frames), nullptr);
+  writer.write(block.data(), reader.capacity());
+  EXPECT_FALSE(reader.release()) << "the writer went over the block in use";
+  EXPECT_EQ(reader.torn, 1ul) << "torn blocks";
+}
+
+TEST(SharedFrame, LatestFrame) {
+  const string name = "pianolizer-test-" + to_string(getpid());
+  auto writer = make_unique<SharedFrameWriter>(name, 61, 8000, 100);
+  SharedFrameReader reader(name);
+  EXPECT_EQ(reader.keys(), 61u) << "keys";
+  EXPECT_NEAR(reader.frameRate(), 80., 1e-9) << "frame rate";
+
+  vector<float> levels(61, -1.f);
+  uint64_t counter = 0;
+  int64_t timestamp = 0;
+  EXPECT_FALSE(reader.read(levels.data(), counter, timestamp)) << "nothing published yet";
+  for (unsigned i = 1; i <= 3; i++) {
+    vector<float> frame(61, static_cast<float>(i) / 10.f);
+    EXPECT_EQ(writer->publish(frame.data(), 1000 * i), i) << "frame counter";
+  }
+  ASSERT_TRUE(reader.read(levels.data(), counter, timestamp));
+  EXPECT_EQ(counter, 3u) << "only the latest frame";
+  EXPECT_EQ(timestamp, 3000) << "timestamp";
+  EXPECT_EQ(levels[60], .3f) << "levels";
+  EXPECT_FALSE(reader.read(levels.data(), counter, timestamp)) << "no newer frame";
+
+  // another process publishes as fast as it can, while this one reads
+  const uint64_t total = 200000;
+  const pid_t child = fork();
+  ASSERT_NE(child, -1);
+  if (child == 0) {
+    vector<float> frame(61);
+    for (uint64_t i = 4; i <= total; i++) {
+      fill(frame.begin(), frame.end(), static_cast<float>(i));
+      writer->publish(frame.data());
+    }
+    _exit(0);
+  }
+  unsigned long reads = 0, torn = 0;
+  uint64_t last = counter;
+  while (counter < total) {
+    if (!reader.read(levels.data(), counter, timestamp))
+      continue;
+    reads++;
+    if (counter <= last || count(levels.begin(), levels.end(), static_cast<float>(counter)) != 61)
+      torn++;
+    last = counter;
+  }
+  int status;
+  ASSERT_EQ(waitpid(child, &status, 0), child);
+  EXPECT_GT(reads, 0ul) << "frames read";
+  EXPECT_EQ(torn, 0ul) << "every frame read whole & in order";
+  EXPECT_LE(SharedFrame::now() - timestamp, 10000000000) << "timestamps from the monotonic clock";
+
+  EXPECT_FALSE(reader.closed()) << "writer alive";
+  writer.reset();
+  EXPECT_TRUE(reader.closed()) << "writer gone";
+}
+
+TEST(SharedFrame, WriterDiedMidUpdate) {
+  const string name = "pianolizer-test-" + to_string(getpid());
+  const pid_t child = fork();
+  ASSERT_NE(child, -1);
+  if (child == 0) {
+    // publishes a frame, then dies in the middle of the next one, as if killed there
+    SharedFrameWriter writer(name, 61, 8000, 100);
+    vector<float> frame(61, .5f);
+    writer.publish(frame.data());
+    const int fd = shm_open(("/" + name).c_str(), O_RDWR, 0);
+    void *base = mmap(nullptr, static_cast<size_t>(sysconf(_SC_PAGESIZE)), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+      _exit(1);
+    reinterpret_cast<atomic<uint64_t>*>(static_cast<char*>(base) + 32)->fetch_add(1);
+    _exit(0);
+  }
+  int status;
+  ASSERT_EQ(waitpid(child, &status, 0), child);
+  ASSERT_EQ(WEXITSTATUS(status), 0);
+
+  SharedFrameReader reader(name);
+  shm_unlink(("/" + name).c_str());
+  vector<float> levels(61, -1.f);
+  uint64_t counter = 0;
+  int64_t timestamp = 0;
+  EXPECT_FALSE(reader.read(levels.data(), counter, timestamp)) << "gives up on the unfinished frame";
+  EXPECT_EQ(reader.stalls, 1ul) << "stalls";
+  EXPECT_EQ(levels[0], -1.f) << "levels left alone";
+  EXPECT_TRUE(reader.closed()) << "writer gone";
+}
+
+TEST(Capture, RoundTrip) {
+  const string path = "/tmp/pianolizer-test-" + to_string(getpid()) + ".pnlzcap";
+  const vector<size_t> sizes = { 512, 512, 300, 2, 512 };
+  const vector<uint64_t> arrivals = { 5800, 11600, 11650, 20000, 5000000000 };
+  vector<float> samples(512);
+  {
+    CaptureWriter writer(path, 2, 44100, 256);
+    for (size_t i = 0; i < sizes.size(); i++) {
+      iota(samples.begin(), samples.end(), static_cast<float>(i) * 1000.f);
+      writer.write(samples.data(), sizes[i], arrivals[i]);
+    }
+    EXPECT_EQ(writer.blocks, sizes.size());
+  }
+  // a block cut short, as if the process died while writing it
+  ASSERT_EQ(truncate(path.c_str(), 8 + 4 * 4 + 4 * (2 * 5 + 512 + 512 + 300 + 2 + 512) - 4), 0);
+
+  CaptureReader reader(path);
+  EXPECT_EQ(reader.channels, 2u);
+  EXPECT_EQ(reader.sampleRate, 44100u);
+  EXPECT_EQ(reader.blockFrames, 256u);
+  for (size_t i = 0; i < 4; i++) {
+    ASSERT_EQ(reader.read(samples.data()), sizes[i]) << "block " << i;
+    EXPECT_EQ(samples[0], static_cast<float>(i) * 1000.f) << "block " << i;
+    EXPECT_EQ(samples[sizes[i] - 1], static_cast<float>(i * 1000 + sizes[i] - 1)) << "block " << i;
+    EXPECT_EQ(reader.time, arrivals[i]) << "block " << i;
+  }
+  EXPECT_EQ(reader.read(samples.data()), 0u) << "the incomplete block is ignored";
+  EXPECT_EQ(reader.blocks, 4ul);
+  unlink(path.c_str());
+
+  EXPECT_THROW(CaptureReader("/tmp/pianolizer-test-nonexistent.pnlzcap"), runtime_error);
+}
+
+TEST(WorkStealingPool, EveryTaskOnce) {
+  WorkStealingPool pool(4);
+  const size_t tasks = 400;
+  vector<atomic<unsigned>> runs(tasks);
+  vector<atomic<unsigned>> perWorker(pool.threads);
+  for (auto& count : runs)
+    count = 0;
+  for (auto& count : perWorker)
+    count = 0;
+
+  // the worker 0 is slow, so the others run out of their own tasks & take over its queue
+  pool.run(vector<double>(tasks, 1.), [&](const unsigned worker, const size_t task) {
+    if (worker == 0)
+      usleep(1000);
+    runs[task]++;
+    perWorker[worker]++;
+  });
+  EXPECT_EQ(count_if(runs.begin(), runs.end(), [](const atomic<unsigned>& count) { return count == 1; }), tasks)
+    << "every task ran exactly once";
+  EXPECT_GT(pool.steals, 0ul) << "steals";
+  EXPECT_LT(perWorker[0], tasks / pool.threads) << "the slow worker got help";
+
+  EXPECT_THROW(
+    pool.run({ 3., 2., 1. }, [](const unsigned, const size_t task) {
+      if (task == 1)
+        throw runtime_error("task failed");
+    }),
+    runtime_error
+  ) << "the exceptions get through";
+}
+
+TEST(DeadlineMonitor, CountsMisses) {
+  auto monitor = DeadlineMonitor(256, 25600);
+  EXPECT_NEAR(monitor.budget, .01, 1e-9) << "budget of the block";
+
+  EXPECT_FALSE(monitor.record(.005)) << "within budget";
+  EXPECT_FALSE(monitor.record(.01)) << "exactly at the budget";
+  EXPECT_TRUE(monitor.record(.02)) << "over budget";
+  EXPECT_FALSE(monitor.record(.005)) << "within budget again";
+
+  EXPECT_EQ(monitor.blocks, static_cast<unsigned long>(4)) << "blocks";
+  EXPECT_EQ(monitor.misses, static_cast<unsigned long>(1)) << "misses";
+  EXPECT_NEAR(monitor.worst, .02, 1e-9) << "worst";
+  EXPECT_NEAR(monitor.load(), 1., 1e-9) << "load";
+
+  monitor.start();
+  EXPECT_FALSE(monitor.stop()) << "nothing takes 10ms";
+  EXPECT_EQ(monitor.blocks, static_cast<unsigned long>(5)) << "timed block";
+}
+
+TEST(OverloadController, StepsWithHysteresis) {
+  const double budget = .01;
+  auto controller = OverloadController(budget, 2);
+  auto run = [&controller](const double load, const double seconds) {
+    unsigned changes = 0;
+    for (unsigned block = 0; block < seconds / .01; block++)
+      changes += controller.update(load * .01);
+    return changes;
+  };
+
+  EXPECT_EQ(run(.7, 10.), 0u) << "between the thresholds, nothing happens";
+  EXPECT_EQ(run(1.2, .1), 1u) << "overload steps down quickly";
+  EXPECT_EQ(controller.step, 1u);
+  EXPECT_EQ(run(1.2, .1), 0u) << "waits for the step to take effect";
+  EXPECT_EQ(run(1.2, 1.), 1u) << "still overloaded; steps down again";
+  EXPECT_EQ(run(1.2, 1.), 0u) << "no more steps";
+  EXPECT_EQ(controller.step, 2u);
+  EXPECT_NE(controller.reason.find("over 90%"), string::npos) << controller.reason;
+
+  EXPECT_EQ(run(.3, 1.9), 0u) << "recovery needs a sustained headroom";
+  EXPECT_EQ(run(.3, .2), 1u) << "steps back up";
+  EXPECT_EQ(controller.step, 1u);
+  EXPECT_NE(controller.reason.find("under 50%"), string::npos) << controller.reason;
+
+  // the recovery was premature
+  EXPECT_EQ(run(1.2, .5), 1u);
+  EXPECT_EQ(controller.requiredHold(), 4.) << "bouncing doubles the hold";
+  EXPECT_EQ(run(.3, 3.5), 0u) << "longer hold";
+  EXPECT_EQ(run(.3, 1.), 1u) << "steps back up after the longer hold";
+  EXPECT_EQ(run(.3, 4.5), 1u) << "full quality again";
+  EXPECT_EQ(controller.step, 0u);
+  EXPECT_EQ(run(.3, 70.), 0u) << "nothing above the full quality";
+  EXPECT_EQ(controller.requiredHold(), 2.) << "stable for long enough; the hold is back to normal";
+  EXPECT_EQ(controller.changes, 6ul);
+}
+
+TEST(OverloadController, StepsDownOnOverrun) {
+  const double budget = .01;
+  auto controller = OverloadController(budget, 2);
+  for (unsigned block = 0; block < 100; block++)
+    controller.update(.5 * budget);
+
+  EXPECT_TRUE(controller.update(5. * budget)) << "a single overrun steps down right away";
+  EXPECT_EQ(controller.step, 1u);
+  EXPECT_NE(controller.reason.find("block took 50.000 ms"), string::npos) << controller.reason;
+  EXPECT_FALSE(controller.update(5. * budget)) << "waits for the step to take effect";
+  EXPECT_EQ(controller.step, 1u);
+
+  unsigned changes = 0;
+  for (unsigned block = 0; block < 100; block++)
+    changes += controller.update(.5 * budget);
+  EXPECT_EQ(changes, 0u) << "no more steps while the load is moderate";
+  EXPECT_TRUE(controller.update(1.1 * budget)) << "the next overrun, once settled, steps down again";
+  EXPECT_EQ(controller.step, 2u);
+}
@@ -62,7 +62,7 @@ class PianolizerWorklet extends AudioWorkletProcessor {
    * @see {@link https://developer.mozilla.org/en-US/docs/Web/API/AudioWorkletProcessor/process}
    * @param {Array} input An array of inputs connected to the node, each item of which is, in turn, an array of channels. Each channel is a Float32Array containing N samples.
    * @param {Array} output Unused.
-   * @param {Object} parameters We only need the value under the key 'smooth'.
+   * @param {Object} parameters We only need the values under the keys 'smooth' & 'threshold'.
    * @return {Boolean} Always returns true, so as to to keep the node alive.
    * @memberof PianolizerWorklet
    */
@@ -94,14 +94,7 @@ class PianolizerWorklet extends AudioWorkletProcessor {
     }
 
     // DO IT!!!
-    const levels = this.pianolizer.process(this.samples, parameters.smooth[0])
-
-    const bands = levels.length
-    for (let i = 0; i < bands; i++) {
-      if (levels[i] < parameters.threshold[0]) {
-        levels[i] = 0
-      }
-    }
+    const levels = this.pianolizer.process(this.samples, parameters.smooth[0], parameters.threshold[0])
     this.port.postMessage(levels)
 
     return true
@@ -33,7 +33,7 @@ class Pianolizer {
     this.samplesView = Module.HEAPF32.subarray(startOffset, endOffset)
   }
 
-  process (samples, averageWindowInSeconds = 0) {
+  process (samples, averageWindowInSeconds = 0, threshold = 0) {
     this.adjustSamplesBuffer(samples.length)
 
     for (let i = 0; i < this.samplesBufferSize; i++) {
@@ -44,7 +44,8 @@ class Pianolizer {
     const levels = this.pianolizer.process(
       this.samplesBuffer,
       this.samplesBufferSize,
-      averageWindowInSeconds
+      averageWindowInSeconds,
+      threshold
     )
 
     return new Float32Array(levels)
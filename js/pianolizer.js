@@ -54,11 +54,20 @@ export default class Pianolizer {
    *
    * @param {Float32Array} samples Array with the batch of samples to process.
    * @param {Number} [averageWindowInSeconds=0] Adjust the moving average window size.
+   * @param {Number} [threshold=0] Noise gate threshold; levels that are not above it become 0.
    * @return {Float32Array} Snapshot of the levels after processing all the samples.
    * @memberof Pianolizer
    */
-  process (samples, averageWindowInSeconds = 0) {
-    return this.slidingDFT.process(samples, averageWindowInSeconds)
+  process (samples, averageWindowInSeconds = 0, threshold = 0) {
+    const levels = this.slidingDFT.process(samples, averageWindowInSeconds)
+
+    // same as OutputTransform (LINEAR scale) of the C++ implementation
+    const bands = levels.length
+    for (let i = 0; i < bands; i++) {
+      levels[i] = levels[i] > threshold ? Math.min(levels[i], 1) : 0
+    }
+
+    return levels
   }
 }
 
@@ -0,0 +1,397 @@
+#!/usr/bin/env perl
+use 5.036;
+
+# reuses the Configuration & the TransientDetector from the transcription script
+use FindBin qw($RealBin);
+BEGIN { require "$RealBin/transcribe2midi.pl" }
+
+package Evaluation {
+    use Moo;
+    use MooX::Options;
+
+    use File::Spec ();
+    use FindBin qw($RealBin);
+
+    # every list option is a sweep: all the combinations get evaluated
+    option buffer_size      => (is => 'ro', format => 'i@', autosplit => ',', default => sub { [554] });
+    option ffmpeg           => (is => 'ro', format => 's', default => sub { 'ffmpeg' });
+    option filters          => (is => 'ro', format => 's', default => sub { 'asubcut=27,asupercut=20000' });
+    option fixtures         => (is => 'ro', format => 's@', autosplit => ',', builder => 1);
+    option flags            => (is => 'ro', format => 's@', default => sub { [''] });
+    option keys             => (is => 'ro', format => 'i', default => sub { 88 });
+    option min_length       => (is => 'ro', format => 'f', default => sub { 0.1 });
+    option onset_tolerance  => (is => 'ro', format => 'f', default => sub { 0.05 });
+    option pianolizer       => (is => 'ro', format => 's', builder => 1);
+    option pitchfork        => (is => 'ro', format => 'f', default => sub { 440.0 });
+    option reference        => (is => 'ro', format => 'i', default => sub { 48 });
+    option sample_rate      => (is => 'ro', format => 'i@', autosplit => ',', default => sub { [46536] });
+    option smoothing        => (is => 'ro', format => 'f@', autosplit => ',', default => sub { [0.04] });
+    option threshold        => (is => 'ro', format => 'f@', autosplit => ',', default => sub { [0.05] });
+    option tolerance        => (is => 'ro', format => 'f@', autosplit => ',', default => sub { [1.0] });
+
+    sub _build_fixtures($self) {
+        return [map {
+            File::Spec->catfile($RealBin, '..', 'audio', $_)
+        } qw(chromatic.mp3 sin.flac saw.flac squ.flac noise.flac)];
+    }
+    sub _build_pianolizer($self) { File::Spec->catfile($RealBin, '..', 'pianolizer') }
+
+    sub BUILD($self, $args) {
+        for my $fixture ($self->fixtures->@*) {
+            die "'$fixture' is not a file!\n\n"
+                unless -f $fixture;
+        }
+        die "'@{[ $self->pianolizer ]}' is not an executable!\n\n"
+            unless -x $self->pianolizer;
+        die "the flags must keep the hexadecimal output!\n\n"
+            if grep { m{ (?: ^ | \s ) -[de] \b }x } $self->flags->@*;
+    }
+
+    sub settings($self) {
+        my @settings = ({});
+        for my $name (qw(sample_rate buffer_size tolerance smoothing threshold flags)) {
+            @settings = map {
+                my $setting = $_;
+                map { +{ %$setting, $name => $_ } } $self->$name->@*;
+            } @settings;
+        }
+        return @settings;
+    }
+}
+
+package Note {
+    use Moo;
+    use Types::Standard qw(Int Num);
+
+    has key         => (is => 'ro', isa => Int, required => 1);
+    has onset       => (is => 'ro', isa => Num, required => 1);
+    has offset      => (is => 'ro', isa => Num, required => 1);
+}
+
+package MIDIFile {
+    # http://www.music.mcgill.ca/~ich/classes/mumt306/StandardMIDIfileformat.html
+    use Moo;
+    use Types::Standard qw(ArrayRef Str);
+
+    has path        => (is => 'ro', isa => Str, required => 1);
+
+    has notes       => (is => 'lazy', isa => ArrayRef);
+    sub _build_notes($self) {
+        open(my $fh, '<:raw', $self->path)
+            || die "can't read '@{[ $self->path ]}'\n\n";
+        my $data = do { local $/; <$fh> };
+        close $fh;
+
+        my ($id, $length, $format, $tracks, $division) = unpack 'a4Nnnn', $data;
+        die "'@{[ $self->path ]}' is not a MIDI file!\n\n"
+            unless $id eq 'MThd';
+        die "'@{[ $self->path ]}' uses SMPTE timing, which is not supported!\n\n"
+            if $division & 0x8000;
+
+        my @events;
+        my $offset = 8 + $length;
+        for (1 .. $tracks) {
+            ($id, $length) = unpack 'a4N', substr($data, $offset, 8);
+            push @events => _parse_track(substr($data, $offset + 8, $length))
+                if $id eq 'MTrk';
+            $offset += 8 + $length;
+        }
+
+        # the tempo changes apply to all the tracks; they come first within the same tick
+        my ($tempo, $last_tick, $time) = (500_000, 0, 0);
+        my (%pending, @notes);
+        for my $event (sort { ($a->[0] <=> $b->[0]) || ($a->[1] cmp $b->[1]) } @events) {
+            my ($tick, $type, $value) = @$event;
+            $time += ($tick - $last_tick) * $tempo / $division / 1_000_000;
+            $last_tick = $tick;
+            if ($type eq '0tempo') {
+                $tempo = $value;
+            } elsif ($type eq '1off') {
+                my $onset = shift $pending{$value}->@*;
+                push @notes => Note->new(key => $value, onset => $onset, offset => $time)
+                    if defined $onset;
+            } else {
+                push $pending{$value}->@* => $time;
+            }
+        }
+
+        return [sort { ($a->onset <=> $b->onset) || ($a->key <=> $b->key) } @notes];
+    }
+
+    sub _parse_track($chunk) {
+        my ($pos, $tick, $running, @events) = (0, 0, 0);
+        my $varlen = sub {
+            my ($value, $byte) = (0);
+            do {
+                $byte = ord substr($chunk, $pos++, 1);
+                $value = ($value << 7) | ($byte & 0x7F);
+            } while ($byte & 0x80);
+            return $value;
+        };
+
+        while ($pos < length $chunk) {
+            $tick += $varlen->();
+            my $status = ord substr($chunk, $pos, 1);
+            if ($status & 0x80) {
+                $pos++;
+            } else {
+                $status = $running;
+            }
+
+            if ($status == 0xFF) {
+                my $meta = ord substr($chunk, $pos++, 1);
+                my $length = $varlen->();
+                push @events => [$tick, '0tempo', unpack('N', "\0" . substr($chunk, $pos, 3))]
+                    if $meta == 0x51;
+                $pos += $length;
+            } elsif ($status == 0xF0 || $status == 0xF7) {
+                $pos += $varlen->();
+            } else {
+                $running = $status;
+                my $type = $status >> 4;
+                if ($type == 0x8 || $type == 0x9) {
+                    my ($key, $velocity) = unpack 'CC', substr($chunk, $pos, 2);
+                    push @events => [$tick, ($type == 0x9 && $velocity) ? '2on' : '1off', $key];
+                }
+                $pos += ($type == 0xC || $type == 0xD) ? 1 : 2;
+            }
+        }
+
+        return @events;
+    }
+}
+
+package GroundTruth {
+    use File::Basename qw(basename);
+
+    # as generated by misc/gen.sh
+    my %synthetic = (
+        'noise.flac'    => [],
+        'saw.flac'      => [[45, 0, 3]],
+        'sin.flac'      => [[69, 0, 3]],
+        'squ.flac'      => [[45, 0, 3]],
+    );
+
+    sub notes($input) {
+        my $midi = $input =~ s{ \. \w+ $ }{.mid}rx;
+        return MIDIFile->new(path => $midi)->notes
+            if -f $midi;
+
+        my $notes = $synthetic{basename($input)}
+            // die "no ground truth for '$input' (neither a .mid file nor a known synthetic fixture)!\n\n";
+        return [map {
+            my ($key, $onset, $offset) = @$_;
+            Note->new(key => $key, onset => $onset, offset => $offset);
+        } @$notes];
+    }
+}
+
+package Score {
+    use Moo;
+    use Types::Standard qw(ArrayRef Num);
+
+    has reference   => (is => 'ro', isa => ArrayRef, required => 1);
+    has detected    => (is => 'ro', isa => ArrayRef, required => 1);
+    has tolerance   => (is => 'ro', isa => Num, required => 1);
+
+    # one-to-one pairs of the same key with the onsets within the tolerance,
+    # closest first (a greedy approximation of the maximum matching)
+    has errors      => (is => 'lazy', isa => ArrayRef);
+    sub _build_errors($self) {
+        my @candidates;
+        for my $i (0 .. $self->reference->$#*) {
+            my $reference = $self->reference->[$i];
+            for my $j (0 .. $self->detected->$#*) {
+                my $detected = $self->detected->[$j];
+                next if $detected->key != $reference->key;
+                my $error = $detected->onset - $reference->onset;
+                push @candidates => [$i, $j, $error]
+                    if abs($error) <= $self->tolerance;
+            }
+        }
+
+        my (%reference, %detected, @errors);
+        for my $candidate (sort { abs($a->[2]) <=> abs($b->[2]) } @candidates) {
+            my ($i, $j, $error) = @$candidate;
+            next if $reference{$i} || $detected{$j};
+            $reference{$i} = $detected{$j} = 1;
+            push @errors => $error;
+        }
+
+        return \@errors;
+    }
+}
+
+package Tally {
+    use Moo;
+    use List::Util qw(sum0);
+    use Types::Standard qw(ArrayRef Int Num);
+
+    has cpu         => (is => 'rw', isa => Num, default => sub { 0 });
+    has detected    => (is => 'rw', isa => Int, default => sub { 0 });
+    has duration    => (is => 'rw', isa => Num, default => sub { 0 });
+    has errors      => (is => 'ro', isa => ArrayRef, default => sub { [] });
+    has reference   => (is => 'rw', isa => Int, default => sub { 0 });
+
+    sub add($self, %args) {
+        $self->cpu($self->cpu + $args{cpu});
+        $self->duration($self->duration + $args{duration});
+        $self->detected($self->detected + $args{score}->detected->@*);
+        $self->reference($self->reference + $args{score}->reference->@*);
+        push $self->errors->@* => $args{score}->errors->@*;
+        return $self;
+    }
+
+    sub ratio($x, $y) { $y ? $x / $y : undef }
+
+    sub precision($self) { ratio(scalar $self->errors->@*, $self->detected) }
+    sub recall($self) { ratio(scalar $self->errors->@*, $self->reference) }
+    sub f1($self) {
+        my ($p, $r) = ($self->precision, $self->recall);
+        return defined($p) && defined($r) ? ratio(2 * $p * $r, $p + $r) // 0 : undef;
+    }
+    sub onset_error($self) { ratio(sum0(map { abs } $self->errors->@*), scalar $self->errors->@*) }
+    sub real_time_factor($self) { ratio($self->cpu, $self->duration) }
+
+    sub columns($self) {
+        my $onset_error = $self->onset_error;
+        my $format = sub ($template, $value) { defined $value ? sprintf($template, $value) : '-' };
+        return (
+            $self->reference,
+            $self->detected,
+            scalar $self->errors->@*,
+            $format->('%.3f', $self->precision),
+            $format->('%.3f', $self->recall),
+            $format->('%.3f', $self->f1),
+            $format->('%.1f', defined $onset_error ? 1000 * $onset_error : undef),
+            $format->('%.4f', $self->real_time_factor),
+        );
+    }
+}
+
+package main {
+    use File::Basename qw(basename);
+    use IPC::Run qw(run);
+    use List::Util qw(pairs);
+    use Term::ProgressBar ();
+
+    my @COLUMNS = qw(
+        fixture sample_rate buffer_size tolerance smoothing threshold flags
+        notes detected matched precision recall f1 onset_ms rtf
+    );
+
+    sub evaluate() {
+        my $evaluation = Evaluation->new_with_options;
+        my @settings = $evaluation->settings;
+        my %reference = map { $_ => GroundTruth::notes($_) } $evaluation->fixtures->@*;
+
+        my $progress = Term::ProgressBar->new({
+            count   => @settings * $evaluation->fixtures->@*,
+            name    => 'Evaluate',
+            remove  => 1,
+        });
+
+        say join "\t" => @COLUMNS;
+        my (%pcm, $n);
+        for my $setting (@settings) {
+            my @setting = map { $_ eq '' ? '-' : $_ } $setting->@{@COLUMNS[1 .. 6]};
+            my $total = Tally->new;
+            for my $fixture ($evaluation->fixtures->@*) {
+                my $pcm = $pcm{"$fixture:$setting->{sample_rate}"} //= decode($evaluation, $fixture, $setting->{sample_rate});
+                my ($detected, $cpu) = transcribe($evaluation, $setting, $fixture, $pcm);
+                my $score = Score->new(
+                    reference   => $reference{$fixture},
+                    detected    => $detected,
+                    tolerance   => $evaluation->onset_tolerance,
+                );
+                my %run = (
+                    cpu         => $cpu,
+                    duration    => length($$pcm) / 4 / $setting->{sample_rate},
+                    score       => $score,
+                );
+                say join "\t" => basename($fixture), @setting, Tally->new->add(%run)->columns;
+                $total->add(%run);
+                $progress->update(++$n);
+            }
+            say join "\t" => 'total', @setting, $total->columns;
+        }
+
+        return 0;
+    }
+
+    sub decode($evaluation, $input, $sample_rate) {
+        my @ffmpeg = (
+            $evaluation->ffmpeg,
+            '-loglevel' => 'error',
+            '-i'        => $input,
+            '-ac'       => 1,
+            '-af'       => $evaluation->filters,
+            '-ar'       => $sample_rate,
+            '-f'        => 'f32le',
+            '-c:a'      => 'pcm_f32le',
+            '-',
+        );
+        my ($pcm, $error);
+        run \@ffmpeg, \undef, \$pcm, \$error
+            or die "can't decode '$input': $error\n\n";
+        return \$pcm;
+    }
+
+    # the real-time factor counts only the CPU time of the analyzer itself
+    sub transcribe($evaluation, $setting, $input, $pcm) {
+        my @pianolizer = (
+            $evaluation->pianolizer,
+            '-a'        => $setting->{smoothing},
+            '-b'        => $setting->{buffer_size},
+            '-k'        => $evaluation->keys,
+            '-p'        => $evaluation->pitchfork,
+            '-r'        => $evaluation->reference,
+            '-s'        => $setting->{sample_rate},
+            '-t'        => $setting->{threshold},
+            '-x'        => $setting->{tolerance},
+            split(' ', $setting->{flags}),
+        );
+        my @before = times;
+        my ($levels, $error);
+        run \@pianolizer, $pcm, \$levels, \$error
+            or die "'@pianolizer' failed: $error\n\n";
+        my @after = times;
+        my $cpu = ($after[2] + $after[3]) - ($before[2] + $before[3]);
+
+        my $config = Configuration->new(
+            buffer_size => $setting->{buffer_size},
+            input       => $input,
+            keys        => $evaluation->keys,
+            min_length  => $evaluation->min_length,
+            output      => '-',
+            pianolizer  => $evaluation->pianolizer,
+            sample_rate => $setting->{sample_rate},
+        );
+        my @detectors = map {
+            TransientDetector->new(config => $config, key => $_)
+        } 0 .. $config->K;
+
+        # -P appends the pitch after the keys
+        my $keys = $evaluation->keys;
+        for my $line (split m{\n}x, $levels) {
+            my @levels = map { $_ / 255 } unpack "C$keys" => pack 'H*' => $line;
+            $detectors[$_]->process($levels[$_]) for 0 .. $config->K;
+        }
+        $_->finalize for @detectors;
+
+        my $offset = 69 - $evaluation->reference;
+        my $factor = $setting->{buffer_size} / $setting->{sample_rate};
+        my @notes = map {
+            my ($on, $off) = @$_;
+            Note->new(
+                key     => $offset + $on->key,
+                onset   => $factor * $on->time,
+                offset  => $factor * $off->time,
+            );
+        } pairs map { $_->events->@* } @detectors;
+
+        return (\@notes, $cpu);
+    }
+
+    exit evaluate();
+}
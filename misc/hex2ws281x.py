@@ -2,11 +2,13 @@
 import argparse
 import re
 import sys
+import time
 
 from rpi_ws281x import PixelStrip, Color
 
 from graceful_killer import GracefulKiller
 from palette import Palette
+from sharedframe import SharedFrame
 
 if __name__ == '__main__':
     parser = argparse.ArgumentParser(description='Pipe pixel colors to a LED strip')
@@ -15,6 +17,8 @@ if __name__ == '__main__':
     parser.add_argument('--skip', default=0, type=int, help='Skip first N LED addresses')
     parser.add_argument('--gpio', default=12, type=int, help='GPIO pin connected to the LED strip')
     parser.add_argument('--brightness', default=255, type=int, help='Set to 0 for darkest and 255 for brightest')
+    parser.add_argument('--shm', help='Show the latest frame published by pianolizer -S SHM instead of reading stdin')
+    parser.add_argument('--fps', default=60, type=float, help='Refresh rate of the LED strip with --shm')
     args = parser.parse_args()
     sys.argv = []
 
@@ -35,26 +39,43 @@ if __name__ == '__main__':
     validator = re.compile(r'^\s*[0-9a-f]{%d}\b' % (KEYS * 2), re.IGNORECASE)
     palette = Palette('palette.json')
 
-    killer = GracefulKiller()
-    while not killer.kill_now:
-        line = sys.stdin.readline()
-        match = validator.match(line)
-        if match:
-            levels = [c / 255 for c in bytes.fromhex(match.group())]
-            leds = list(
-                map(
-                    lambda c: Color(c[0], c[1], c[2]),
-                    palette.getKeyColors(levels)
-                )
+    def show(levels):
+        leds = list(
+            map(
+                lambda c: Color(c[0], c[1], c[2]),
+                palette.getKeyColors(levels)
             )
+        )
+
+        for key in range(len(leds)):
+            color = leds[key]
+            for i in range(LEDS_PER_KEY):
+                strip.setPixelColor(LED_OFFSET + key * LEDS_PER_KEY + i, color)
+        strip.show()
 
-            for key in range(len(leds)):
-                color = leds[key]
-                for i in range(LEDS_PER_KEY):
-                    strip.setPixelColor(LED_OFFSET + key * LEDS_PER_KEY + i, color)
-            strip.show()
-        else:
-            print(f'bad input: {line.strip()}')
+    killer = GracefulKiller()
+    if args.shm:
+        # no queue to fall behind on: whenever the strip is ready, it gets the newest frame
+        frame = SharedFrame(args.shm)
+        period = 1 / args.fps
+        while not killer.kill_now and not frame.closed:
+            started = time.monotonic()
+            latest = frame.read()
+            if latest:
+                levels, age = latest
+                show(levels[:KEYS])
+            time.sleep(max(period - (time.monotonic() - started), 0))
+        print(f'{frame.frame} frames, {frame.skipped} skipped')
+        if frame.stalls:
+            print(f'{frame.stalls} reads gave up on an unfinished frame; the writer stalled or died while publishing')
+    else:
+        while not killer.kill_now:
+            line = sys.stdin.readline()
+            match = validator.match(line)
+            if match:
+                show([c / 255 for c in bytes.fromhex(match.group())])
+            else:
+                print(f'bad input: {line.strip()}')
 
     black = Color(0, 0, 0)
     for i in range(LED_COUNT):
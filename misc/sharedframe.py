@@ -0,0 +1,73 @@
+import mmap
+import os
+import struct
+import time
+
+class SharedFrame:
+    '''
+    Reads the latest frame published by `pianolizer -S NAME` (see cpp/sharedframe.hpp for the layout).
+    '''
+    HEADER = struct.Struct('=8sIIIIiI')
+    SEQUENCE = struct.Struct('=Q')
+    PAYLOAD = struct.Struct('=Qq')
+    CLOSED = struct.Struct('=I')
+    CLOSED_OFFSET = 28
+    SEQUENCE_OFFSET = 32
+    PAYLOAD_OFFSET = 40
+    VALUES_OFFSET = 56
+    # far longer than an update takes, unless the writer was preempted or died in it
+    MAX_RETRIES = 100000
+
+    def __init__(self, name):
+        path = '/dev/shm/' + name.lstrip('/')
+        with open(path, 'rb') as file:
+            self.memory = mmap.mmap(file.fileno(), 0, access=mmap.ACCESS_READ)
+
+        magic, version, self.keys, sample_rate, block_size, self.pid, _ = self.HEADER.unpack_from(self.memory)
+        if magic != b'PNLZFRAM' or version != 1:
+            raise ValueError(f'not a pianolizer frame: {path}')
+        self.frame_rate = sample_rate / block_size
+        self.values = struct.Struct(f'={self.keys}f')
+
+        self.frame = 0
+        self.skipped = 0
+        self.stalls = 0
+
+    def read(self):
+        '''
+        Returns the levels of the newest frame & its age, in seconds; None when there is nothing new.
+        The frames published in between are counted in `skipped`. An update that does not finish within
+        MAX_RETRIES (the writer died halfway through it, see `closed`) also gives None, & is counted in `stalls`.
+        '''
+        for _ in range(self.MAX_RETRIES + 1):
+            before, = self.SEQUENCE.unpack_from(self.memory, self.SEQUENCE_OFFSET)
+            if before & 1:
+                continue
+            frame, timestamp = self.PAYLOAD.unpack_from(self.memory, self.PAYLOAD_OFFSET)
+            if frame == self.frame:
+                return None
+            levels = self.values.unpack_from(self.memory, self.VALUES_OFFSET)
+            after, = self.SEQUENCE.unpack_from(self.memory, self.SEQUENCE_OFFSET)
+            if after == before:
+                break
+        else:
+            self.stalls += 1
+            return None
+
+        if self.frame:
+            self.skipped += frame - self.frame - 1
+        self.frame = frame
+        return list(levels), (time.monotonic_ns() - timestamp) / 1e9
+
+    @property
+    def closed(self):
+        closed, = self.CLOSED.unpack_from(self.memory, self.CLOSED_OFFSET)
+        if closed:
+            return True
+        try:
+            os.kill(self.pid, 0)
+        except ProcessLookupError:
+            return True
+        except PermissionError:
+            pass
+        return False